@@ -0,0 +1,277 @@
+#include "ControlRateInference.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <cmath>
+
+ControlRateInference::ControlRateInference(
+    juce::AudioProcessorValueTreeState &vts,
+    InferenceTelemetry &telemetry
+)
+    : mTelemetry(telemetry)
+{
+    const char *parameterIDs[kNumParameters] = {
+        "xpos",
+        "ypos",
+        "density",
+        "stiffness",
+        "pratio",
+        "alpha",
+        "beta"};
+
+    for (int i = 0; i < kNumParameters; i++)
+    {
+        mParameterValues[i] = vts.getRawParameterValue(parameterIDs[i]);
+        jassert(mParameterValues[i] != nullptr);
+    }
+}
+
+void ControlRateInference::setEnabled(bool enabled)
+{
+    mEnabled = enabled;
+}
+
+bool ControlRateInference::isEnabled() const
+{
+    return mEnabled;
+}
+
+bool ControlRateInference::isActive(bool extrapolation) const
+{
+    return (mEnabled && mHasEvaluator) ||
+           (extrapolation && mExtrapolationEnabled && mHasLinearization);
+}
+
+void ControlRateInference::setExtrapolationEnabled(bool enabled)
+{
+    mExtrapolationEnabled = enabled;
+}
+
+bool ControlRateInference::isExtrapolationEnabled() const
+{
+    return mExtrapolationEnabled;
+}
+
+void ControlRateInference::setExtrapolationBounds(
+    float maxDelta,
+    float maxError
+)
+{
+    mMaxExtrapolationDelta = maxDelta;
+    mMaxExtrapolationError = maxError;
+}
+
+void ControlRateInference::setInterval(int numSamples)
+{
+    mInterval = std::max(numSamples, 1);
+}
+
+int ControlRateInference::getInterval() const
+{
+    return mInterval;
+}
+
+void ControlRateInference::setPrefix(
+    std::shared_ptr<const MLPEvaluator> evaluator,
+    const std::vector<float> &prefix
+)
+{
+    // allocate here, on the torch thread
+    MLPEvaluator::Workspace workspace;
+    if (evaluator) { workspace = evaluator->createWorkspace(); }
+
+    {
+        const juce::SpinLock::ScopedLockType lock(mPendingLock);
+        mPendingEvaluator = evaluator;
+        mPendingPrefix = prefix;
+        std::swap(mPendingWorkspace, workspace);
+        mPendingAvailable = true;
+    }
+
+    mHasEvaluator = evaluator != nullptr;
+}
+
+void ControlRateInference::setLinearization(
+    const CoefficientLinearization &linearization
+)
+{
+    {
+        // copy assignment reuses the pending buffers, so the allocations
+        // stay on this thread
+        const juce::SpinLock::ScopedLockType lock(mPendingLock);
+        mPendingLinearization = linearization;
+        mPendingLinearizationAvailable = true;
+    }
+
+    mHasLinearization = !linearization.coefficients.empty();
+}
+
+uint64_t ControlRateInference::getNumRejectedExtrapolations() const
+{
+    return mNumRejectedExtrapolations;
+}
+
+bool ControlRateInference::isStable(const std::vector<float> &coefficients)
+{
+    // a biquad with a1, a2 normalised by a0 is stable inside the
+    // stability triangle |a2| < 1, |a1| < 1 + a2
+    for (size_t i = 0; i + 5 < coefficients.size(); i += 6)
+    {
+        float a1 = coefficients[i + 4];
+        float a2 = coefficients[i + 5];
+        if (!(std::abs(a2) < 1.0f && std::abs(a1) < 1.0f + a2))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ControlRateInference::process(
+    std::vector<float> &coefficients,
+    bool extrapolation
+)
+{
+    // pick up a new evaluator, prefix or linearization if the torch thread
+    // is not writing one right now, otherwise try again at the next call
+    {
+        const juce::SpinLock::ScopedTryLockType lock(mPendingLock);
+        if (lock.isLocked() && mPendingAvailable)
+        {
+            std::swap(mEvaluator, mPendingEvaluator);
+            std::swap(mPrefix, mPendingPrefix);
+            std::swap(mWorkspace, mPendingWorkspace);
+            mPendingAvailable = false;
+            mNeedsEvaluation = true;
+        }
+        if (lock.isLocked() && mPendingLinearizationAvailable)
+        {
+            std::swap(mLinearization, mPendingLinearization);
+            mPendingLinearizationAvailable = false;
+            mNeedsEvaluation = true;
+        }
+    }
+
+    readParameters(mParameters);
+    bool changed = !std::equal(
+        mParameters,
+        mParameters + kNumParameters,
+        mLastParameters
+    );
+    if (!changed && !mNeedsEvaluation)
+    {
+        return false;
+    }
+
+    // a failed attempt is not retried until the parameters change or the
+    // torch thread hands over something new
+    std::copy(mParameters, mParameters + kNumParameters, mLastParameters);
+    mNeedsEvaluation = false;
+
+    if (mEnabled && evaluate(coefficients)) { return true; }
+    return extrapolation && mExtrapolationEnabled &&
+           extrapolate(coefficients);
+}
+
+bool ControlRateInference::evaluate(std::vector<float> &coefficients)
+{
+    if (!mEvaluator ||
+        size_t(mEvaluator->getNumOutputs()) != coefficients.size() ||
+        size_t(mEvaluator->getPrefixSize()) != mPrefix.size())
+    {
+        return false;
+    }
+
+    auto start = juce::Time::getHighResolutionTicks();
+
+    mEvaluator->forwardWithPrefix(
+        mPrefix.data(),
+        mParameters,
+        mEvaluator->getNumInputs() - kNumParameters,
+        coefficients.data(),
+        mWorkspace
+    );
+
+    auto cost = juce::Time::highResolutionTicksToSeconds(
+                    juce::Time::getHighResolutionTicks() - start
+                ) *
+                1e6;
+    mLastCost = cost;
+    mTelemetry.recordMicroseconds(InferenceTelemetry::Stage::FCForward, cost);
+    if (cost > mWorstCaseCost) { mWorstCaseCost = cost; }
+    return true;
+}
+
+bool ControlRateInference::extrapolate(std::vector<float> &coefficients)
+{
+    const auto &linearization = mLinearization;
+    auto numCoefficients = coefficients.size();
+    if (linearization.coefficients.size() != numCoefficients ||
+        linearization.jacobian.size() != numCoefficients * kNumParameters)
+    {
+        return false;
+    }
+
+    float delta[kNumParameters];
+    float maxDelta = 0.0f;
+    for (int i = 0; i < kNumParameters; i++)
+    {
+        delta[i] = mParameters[i] - linearization.parameters[size_t(i)];
+        maxDelta = std::max(maxDelta, std::abs(delta[i]));
+    }
+
+    // beyond the bound the torch thread's result is awaited instead
+    if (maxDelta > mMaxExtrapolationDelta ||
+        linearization.curvature * maxDelta * maxDelta >
+            mMaxExtrapolationError)
+    {
+        mNumRejectedExtrapolations++;
+        return false;
+    }
+
+    const float *row = linearization.jacobian.data();
+    for (size_t i = 0; i < numCoefficients; i++, row += kNumParameters)
+    {
+        float value = linearization.coefficients[i];
+        for (int j = 0; j < kNumParameters; j++)
+        {
+            value += row[j] * delta[j];
+        }
+        coefficients[i] = value;
+    }
+
+    if (!isStable(coefficients))
+    {
+        mNumRejectedExtrapolations++;
+        return false;
+    }
+    return true;
+}
+
+double ControlRateInference::getLastCostMicroseconds() const
+{
+    return mLastCost;
+}
+
+double ControlRateInference::getWorstCaseCostMicroseconds() const
+{
+    return mWorstCaseCost;
+}
+
+void ControlRateInference::resetWorstCaseCost()
+{
+    mWorstCaseCost = 0.0;
+}
+
+void ControlRateInference::readParameters(float *parameters) const
+{
+    // the ui lives in a space centred on the origin with the y axis
+    // pointing up, the network expects [0, 1] with the origin in the top
+    // left corner (see TorchWrapper)
+    parameters[0] = (mParameterValues[0]->load() + 1.0f) * 0.5f;
+    parameters[1] = 1.0f - ((mParameterValues[1]->load() + 1.0f) * 0.5f);
+
+    for (int i = 2; i < kNumParameters; i++)
+    {
+        parameters[i] = mParameterValues[i]->load();
+    }
+}
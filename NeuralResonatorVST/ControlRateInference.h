@@ -0,0 +1,168 @@
+#pragma once
+
+#include "MLPEvaluator.h"
+#include "InferenceTelemetry.h"
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief  First order expansion of the fc network around one parameter set
+ * @note   Computed by the torch thread with autograd for the current shape
+ */
+struct CoefficientLinearization
+{
+    // position and material, in the order of the fc input
+    std::array<float, 7> parameters{};
+    // the coefficients at parameters
+    std::vector<float> coefficients;
+    // d(coefficients) / d(parameters), row major, coefficients x parameters
+    std::vector<float> jacobian;
+    // estimate of the second order term, max coefficient error divided by
+    // the squared max parameter delta, 0 until it has been observed once
+    float curvature = 0.0f;
+};
+
+/**
+ * @brief  Evaluates the fc network on the audio thread at control rate
+ * @note   The torch thread hands over the native evaluator and the cached
+ * feature part of its first layer (setPrefix). The audio thread then reads
+ * the parameter atomics and, if they changed, evaluates the network itself
+ * (process), so material and position automation is applied block aligned
+ * without depending on the timing of the torch thread. Everything the
+ * audio thread touches is allocated on the torch thread, and the cost of
+ * every evaluation is measured.
+ * If the network can not be evaluated natively, the coefficients can
+ * instead be extrapolated from the last linearization (setLinearization)
+ * while the torch thread catches up, as long as the estimated error stays
+ * within bounds and every biquad stays stable.
+ */
+class ControlRateInference
+{
+public:
+    static constexpr int kNumParameters = 7;
+
+    ControlRateInference(
+        juce::AudioProcessorValueTreeState& vts,
+        InferenceTelemetry& telemetry
+    );
+
+    void setEnabled(bool enabled);
+    bool isEnabled() const;
+
+    /**
+     * @brief  Enable extrapolation from the last linearization
+     */
+    void setExtrapolationEnabled(bool enabled);
+    bool isExtrapolationEnabled() const;
+
+    /**
+     * @brief  Set the error bound of the extrapolation
+     * @param  maxDelta: max parameter change from the linearization point
+     * @param  maxError: max estimated coefficient error
+     */
+    void setExtrapolationBounds(float maxDelta, float maxError);
+
+    /**
+     * @brief  Whether the audio thread updates the coefficients, i.e. a mode
+     * is enabled and the evaluator or a linearization has been received
+     * @param  extrapolation: false to leave the extrapolation out, e.g.
+     * during offline renders
+     */
+    bool isActive(bool extrapolation = true) const;
+
+    /**
+     * @brief  Set the evaluation interval in samples
+     */
+    void setInterval(int numSamples);
+    int getInterval() const;
+
+    /**
+     * @brief  Hand over a new evaluator or prefix, from the torch thread
+     * @param  evaluator: the native fc evaluator, or nullptr if there is
+     * none
+     * @param  prefix: the feature part of the first layer for the current
+     * shape
+     */
+    void setPrefix(
+        std::shared_ptr<const MLPEvaluator> evaluator,
+        const std::vector<float>& prefix
+    );
+
+    /**
+     * @brief  Hand over a new linearization, from the torch thread
+     */
+    void setLinearization(const CoefficientLinearization& linearization);
+
+    /**
+     * @brief  Number of extrapolations rejected by the error bound or the
+     * stability check, the torch thread's result is used instead
+     */
+    uint64_t getNumRejectedExtrapolations() const;
+
+    /**
+     * @brief  Check that every biquad has its poles inside the unit circle
+     * @param  coefficients: b0, b1, b2, a0, a1, a2 per biquad, normalised
+     * by a0
+     */
+    static bool isStable(const std::vector<float>& coefficients);
+
+    /**
+     * @brief  Evaluate the network if the parameters or the prefix changed,
+     * from the audio thread
+     * @param  coefficients: the output, sized to the number of coefficients
+     * @param  extrapolation: false to only evaluate the network
+     * @retval true if the coefficients were updated
+     */
+    bool process(std::vector<float>& coefficients, bool extrapolation = true);
+
+    double getLastCostMicroseconds() const;
+    double getWorstCaseCostMicroseconds() const;
+    void resetWorstCaseCost();
+
+private:
+    void readParameters(float* parameters) const;
+    bool evaluate(std::vector<float>& coefficients);
+    bool extrapolate(std::vector<float>& coefficients);
+
+private:
+    // parameter atomics in the order of the fc input: position, material
+    std::atomic<float>* mParameterValues[kNumParameters];
+    InferenceTelemetry& mTelemetry;
+
+    // handed over by the torch thread, swapped in by the audio thread. The
+    // swap leaves the previous evaluator here, so it is released on the
+    // torch thread and never on the audio thread.
+    juce::SpinLock mPendingLock;
+    std::shared_ptr<const MLPEvaluator> mPendingEvaluator;
+    std::vector<float> mPendingPrefix;
+    MLPEvaluator::Workspace mPendingWorkspace;
+    bool mPendingAvailable = false;
+    CoefficientLinearization mPendingLinearization;
+    bool mPendingLinearizationAvailable = false;
+
+    // audio thread state
+    std::shared_ptr<const MLPEvaluator> mEvaluator;
+    std::vector<float> mPrefix;
+    MLPEvaluator::Workspace mWorkspace;
+    CoefficientLinearization mLinearization;
+    float mParameters[kNumParameters] = {};
+    float mLastParameters[kNumParameters] = {};
+    bool mNeedsEvaluation = true;
+
+    std::atomic<bool> mEnabled{false};
+    std::atomic<bool> mHasEvaluator{false};
+    std::atomic<bool> mExtrapolationEnabled{false};
+    std::atomic<bool> mHasLinearization{false};
+    std::atomic<float> mMaxExtrapolationDelta{0.1f};
+    std::atomic<float> mMaxExtrapolationError{0.01f};
+    std::atomic<uint64_t> mNumRejectedExtrapolations{0};
+    std::atomic<int> mInterval{32};
+    std::atomic<double> mLastCost{0.0};
+    std::atomic<double> mWorstCaseCost{0.0};
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ControlRateInference)
+};
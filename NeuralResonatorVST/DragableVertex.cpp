@@ -55,17 +55,26 @@ void DragableVertex::mouseUp(const juce::MouseEvent &e)
     {
         // JLOG("MOUSE UP IN DRAGABLE VERTEX");
         // send a message to the parent component
-        getParentComponent()->postCommandMessage(0);
+        getParentComponent()->postCommandMessage(kShapeCommitted);
     }
 }
 
 void DragableVertex::mouseDown(const juce::MouseEvent &e)
 {
     mOldPos = mRelativePos;
+    mPreviewPos = mRelativePos;
     mDragger.startDraggingComponent(this, e);
 }
 
 void DragableVertex::mouseDrag(const juce::MouseEvent &e)
 {
     mDragger.dragComponent(this, e, &constrainer);
+
+    // the parent runs a cheap inference for every step of the drag, and the
+    // full one on mouseUp
+    if (mSendsPreview && mPreviewPos != mRelativePos)
+    {
+        mPreviewPos = mRelativePos;
+        getParentComponent()->postCommandMessage(kShapePreview);
+    }
 }
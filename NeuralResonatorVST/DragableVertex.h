@@ -5,6 +5,14 @@
 class DragableVertex : public juce::Component
 {
 public:
+    // command messages posted to the parent component
+    enum CommandIds
+    {
+        kShapeCommitted = 0,
+        kExciterMoved = 1,
+        kShapePreview = 2
+    };
+
     DragableVertex(const juce::Point<float> &initialPos);
 
     void paint(juce::Graphics &g) override;
@@ -16,8 +24,14 @@ public:
 
 public:
     juce::Point<float> mRelativePos;
+
+protected:
+    // whether every step of a drag is posted as a preview
+    bool mSendsPreview = true;
+
 private:
     juce::Point<float> mOldPos;
+    juce::Point<float> mPreviewPos;
 
     juce::ComponentBoundsConstrainer constrainer;
     juce::ComponentDragger mDragger;
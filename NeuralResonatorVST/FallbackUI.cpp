@@ -37,21 +37,30 @@ void ShapeComponent::handleCommandMessage(int commandId)
     auto invertedPos =
         mExciter->mRelativePos.transformedBy(mMainTransform.inverted());
     // update the tree
-    if (commandId == 0)
+    if (commandId == DragableVertex::kShapePreview)
     {
-        auto polygonTree = mVts.state.getChildWithName("polygon");
-
-        juce::Array<juce::var> vertices;
-
-        for (auto *vertex : mVertices)
+        // the vertices are kept while dragging, only the path follows
         {
-            vertices.add(juce::var(invertedPos.x));
-            vertices.add(juce::var(invertedPos.y));
+            const juce::SpinLock::ScopedLockType lock(mMutex);
+            updatePathFromVertices();
         }
 
-        polygonTree.setProperty("value", vertices, nullptr);
+        auto polygonTree = mVts.state.getChildWithName("polygon");
+        polygonTree.setProperty(
+            "preview",
+            getFlattenedVertices(),
+            nullptr
+        );
+    }
+    else if (commandId == DragableVertex::kShapeCommitted)
+    {
+        auto polygonTree = mVts.state.getChildWithName("polygon");
+
+        // the preview is not part of the state
+        polygonTree.removeProperty("preview", nullptr);
+        polygonTree.setProperty("value", getFlattenedVertices(), nullptr);
     }
-    else if (commandId == 1)
+    else if (commandId == DragableVertex::kExciterMoved)
     {
         // update the tree
         auto xpos = mVts.state.getChildWithProperty("id", "xpos");
@@ -62,6 +71,33 @@ void ShapeComponent::handleCommandMessage(int commandId)
     }
 }
 
+juce::Array<juce::var> ShapeComponent::getFlattenedVertices() const
+{
+    auto inverse = mMainTransform.inverted();
+
+    juce::Array<juce::var> vertices;
+    for (auto *vertex : mVertices)
+    {
+        auto pos = vertex->mRelativePos.transformedBy(inverse);
+        vertices.add(juce::var(pos.x));
+        vertices.add(juce::var(pos.y));
+    }
+    return vertices;
+}
+
+void ShapeComponent::updatePathFromVertices()
+{
+    mPath.clear();
+    for (int i = 0; i < mVertices.size(); i++)
+    {
+        auto pos = mVertices[i]->mRelativePos;
+        if (i == 0) { mPath.startNewSubPath(pos); }
+        else { mPath.lineTo(pos); }
+    }
+    mPath.closeSubPath();
+    repaint();
+}
+
 void ShapeComponent::resized()
 {
     auto margin = getWidth() - getHeight();
@@ -141,7 +177,10 @@ void ShapeComponent::valueTreePropertyChanged(
 
     auto treeType = changedTree.getType().toString();
 
-    if (treeType == "polygon")
+    // previews come from the vertices of this component, rebuilding them
+    // would end the drag
+    if (treeType == "polygon" &&
+        changedProperty != "preview")
     {
         // JLOG("ShapeComponent::valueTreePropertyChanged polygon changed");
         if (auto *flattenedVertices =
@@ -188,6 +227,9 @@ Panel::Panel(juce::AudioProcessorValueTreeState &VTS)
     , mBetaAttachment(VTS, "beta", mBetaSlider)
     , mNumVerticesSlider("Number of Vertices")
     , mNewShapeButton("New Shape")
+    , mMorphAttachment(VTS, "morph", mMorphSlider)
+    , mStoreShapeButton("Store Shape")
+    , mClearShapesButton("Clear Shapes")
 {
     // add the sliders with labels
     addAndMakeVisible(mDensitySlider);
@@ -262,12 +304,44 @@ Panel::Panel(juce::AudioProcessorValueTreeState &VTS)
         polygonTree.setProperty("value", vertices, nullptr);
     };
     addAndMakeVisible(mNewShapeButton);
+
+    addAndMakeVisible(mMorphSlider);
+
+    addAndMakeVisible(mMorphLabel);
+    mMorphLabel.setText("Morph", juce::dontSendNotification);
+    mMorphLabel.attachToComponent(&mMorphSlider, true);
+
+    // append the current shape to the morph targets
+    mStoreShapeButton.onClick = [this]()
+    {
+        auto polygonTree =
+            mVTSRef.state.getOrCreateChildWithName("polygon", nullptr);
+        auto morphTree =
+            mVTSRef.state.getOrCreateChildWithName("morph", nullptr);
+
+        juce::Array<juce::var> slots;
+        if (auto *stored = morphTree.getProperty("slots").getArray())
+        {
+            slots = *stored;
+        }
+        slots.add(polygonTree.getProperty("value"));
+        morphTree.setProperty("slots", slots, nullptr);
+    };
+    addAndMakeVisible(mStoreShapeButton);
+
+    mClearShapesButton.onClick = [this]()
+    {
+        auto morphTree =
+            mVTSRef.state.getOrCreateChildWithName("morph", nullptr);
+        morphTree.setProperty("slots", juce::Array<juce::var>(), nullptr);
+    };
+    addAndMakeVisible(mClearShapesButton);
 }
 
 void Panel::resized()
 {
     auto area = getLocalBounds();
-    auto sliderHeight = area.getHeight() / 6;
+    auto sliderHeight = area.getHeight() / 8;
 
     // leave some space on the left for the label
     int labelWidth = 50;
@@ -318,4 +392,19 @@ void Panel::resized()
         area.getWidth() / 2,
         sliderHeight
     );
+
+    mMorphSlider.setBounds(
+        labelWidth,
+        6 * sliderHeight,
+        area.getWidth() - labelWidth,
+        sliderHeight
+    );
+    mStoreShapeButton
+        .setBounds(0, 7 * sliderHeight, area.getWidth() / 2, sliderHeight);
+    mClearShapesButton.setBounds(
+        area.getWidth() / 2,
+        7 * sliderHeight,
+        area.getWidth() / 2,
+        sliderHeight
+    );
 }
@@ -16,6 +16,8 @@ public:
     ExciterVertex(const juce::Point<float>& initialPos)
         : DragableVertex(initialPos)
     {
+        // the exciter does not change the shape
+        mSendsPreview = false;
     }
 
     void paint(juce::Graphics& g) override
@@ -33,7 +35,7 @@ public:
     {
         JLOG("MOUSE UP");
         // send a message to the parent component
-        getParentComponent()->postCommandMessage(1);
+        getParentComponent()->postCommandMessage(kExciterMoved);
     }
 };
 
@@ -58,6 +60,17 @@ public:
         const juce::Identifier& changedProperty
     ) override;
 
+private:
+    /**
+     * @brief  The vertices in the [-1, 1] space of the polygon tree
+     */
+    juce::Array<juce::var> getFlattenedVertices() const;
+
+    /**
+     * @brief  Rebuild the path from the current vertex positions
+     */
+    void updatePathFromVertices();
+
 private:
     juce::Path mPath;
     juce::SpinLock mMutex;
@@ -93,6 +106,12 @@ private:
     juce::Slider mNumVerticesSlider;
     juce::TextButton mNewShapeButton;
 
+    // morph between the current shape and the stored ones
+    juce::Slider mMorphSlider;
+    juce::Label mMorphLabel;
+    juce::AudioProcessorValueTreeState::SliderAttachment mMorphAttachment;
+    juce::TextButton mStoreShapeButton, mClearShapesButton;
+
 private:
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(Panel)
 };
\ No newline at end of file
@@ -91,10 +91,20 @@ void Filterbank::setCoefficients(
 }
 
 void Filterbank::processBuffer(juce::AudioBuffer<float>& buffer)
+{
+    processBuffer(buffer, 0, buffer.getNumSamples());
+}
+
+void Filterbank::processBuffer(
+    juce::AudioBuffer<float>& buffer,
+    int startSample,
+    int numSamples
+)
 {
     const juce::SpinLock::ScopedLockType lock(mProcessLock);
 
-    for (int sampleIdx = 0; sampleIdx < buffer.getNumSamples(); sampleIdx++)
+    for (int sampleIdx = startSample; sampleIdx < startSample + numSamples;
+         sampleIdx++)
     {
         for (int channel = 0; channel < buffer.getNumChannels(); channel++)
         {
@@ -32,6 +32,19 @@ public:
      */
     void processBuffer(juce::AudioBuffer<float>& buffer);
 
+    /**
+     * @brief  Process a range of samples through the filterbank
+     * @param  buffer: The buffer, processed in place
+     * @param  startSample: The first sample to process
+     * @param  numSamples: The number of samples to process
+     * @retval None
+     */
+    void processBuffer(
+        juce::AudioBuffer<float>& buffer,
+        int startSample,
+        int numSamples
+    );
+
     void setInterpolationDelta(unsigned int delta);
 
 private:
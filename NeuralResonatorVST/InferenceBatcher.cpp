@@ -0,0 +1,202 @@
+#include "InferenceBatcher.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+InferenceBatcher::InferenceBatcher() = default;
+
+InferenceBatcher::~InferenceBatcher()
+{
+    mStrand.stop();
+}
+
+void InferenceBatcher::submit(
+    const void *owner,
+    uint64_t modelHash,
+    const torch::jit::Module &network,
+    std::vector<float> input,
+    Callback callback
+)
+{
+    bool flushNow = false;
+    bool flushLater = false;
+    {
+        const juce::ScopedLock lock(mLock);
+
+        // a newer input of the same instance supersedes the waiting one
+        auto it = std::find_if(
+            mPending.begin(),
+            mPending.end(),
+            [owner](const Request &request)
+            { return request.owner == owner; }
+        );
+        if (it == mPending.end()) { it = mPending.insert(it, Request()); }
+
+        it->owner = owner;
+        it->modelHash = modelHash;
+        it->network = network;
+        it->input = std::move(input);
+        it->callback = std::move(callback);
+
+        // collect for the window, a full batch starts right away
+        flushNow = mPending.size() >= size_t(mMaxBatchSize.load()) ||
+                   mWindowMs <= 0.0;
+        flushLater = !flushNow && !mFlushScheduled;
+        mFlushScheduled = mFlushScheduled || flushLater;
+    }
+
+    // outside the lock, an inline executor runs the flush right here
+    if (flushNow) { mStrand.post([this] { flush(); }); }
+    else if (flushLater)
+    {
+        mStrand.postAfter(
+            std::max(1, int(std::ceil(mWindowMs.load()))),
+            [this] { flush(); }
+        );
+    }
+}
+
+void InferenceBatcher::cancel(const void *owner)
+{
+    {
+        const juce::ScopedLock lock(mLock);
+        mPending.erase(
+            std::remove_if(
+                mPending.begin(),
+                mPending.end(),
+                [owner](const Request &request)
+                { return request.owner == owner; }
+            ),
+            mPending.end()
+        );
+        if (mBatchRunning) { mCancelled.push_back(owner); }
+    }
+
+    // wait for a callback that is already running
+    const juce::ScopedLock callbackLock(mCallbackLock);
+}
+
+void InferenceBatcher::setWindow(double milliseconds)
+{
+    mWindowMs = milliseconds;
+}
+
+void InferenceBatcher::setMaxBatchSize(int maxBatchSize)
+{
+    mMaxBatchSize = std::max(maxBatchSize, 1);
+}
+
+uint64_t InferenceBatcher::getNumBatches() const
+{
+    return mNumBatches;
+}
+
+uint64_t InferenceBatcher::getNumRequests() const
+{
+    return mNumRequests;
+}
+
+void InferenceBatcher::flush()
+{
+    std::vector<Request> requests;
+    {
+        const juce::ScopedLock lock(mLock);
+        requests.swap(mPending);
+        mBatchRunning = !requests.empty();
+        // the next request starts a new window
+        mFlushScheduled = false;
+    }
+    // a full batch may have been flushed before the window ran out
+    if (requests.empty()) { return; }
+
+    runBatches(requests);
+
+    const juce::ScopedLock lock(mLock);
+    mBatchRunning = false;
+    mCancelled.clear();
+}
+
+void InferenceBatcher::runBatches(std::vector<Request> &requests)
+{
+    // requests of the same model are evaluated together
+    std::stable_sort(
+        requests.begin(),
+        requests.end(),
+        [](const Request &a, const Request &b)
+        { return a.modelHash < b.modelHash; }
+    );
+
+    auto maxBatchSize = size_t(mMaxBatchSize.load());
+    size_t first = 0;
+    while (first < requests.size())
+    {
+        size_t last = first + 1;
+        while (last < requests.size() && last - first < maxBatchSize &&
+               requests[last].modelHash == requests[first].modelHash &&
+               requests[last].input.size() == requests[first].input.size())
+        {
+            last++;
+        }
+        runBatch(requests.data() + first, last - first);
+        first = last;
+    }
+}
+
+void InferenceBatcher::runBatch(Request *requests, size_t numRequests)
+{
+    auto numInputs = int64_t(requests[0].input.size());
+    torch::Tensor output;
+
+    c10::InferenceMode guard;
+    try
+    {
+        auto input = torch::empty({int64_t(numRequests), numInputs});
+        auto *rows = input.data_ptr<float>();
+        for (size_t i = 0; i < numRequests; i++)
+        {
+            std::memcpy(
+                rows + int64_t(i) * numInputs,
+                requests[i].input.data(),
+                size_t(numInputs) * sizeof(float)
+            );
+        }
+
+        std::vector<torch::jit::IValue> inputs{input};
+        output = requests[0]
+                     .network.forward(inputs)
+                     .toTensor()
+                     .reshape({int64_t(numRequests), -1})
+                     .contiguous();
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG("Error running a batched forward: " + std::string(e.what()));
+        jassertfalse;
+        return;
+    }
+    mNumBatches++;
+    mNumRequests += numRequests;
+
+    // scatter the rows back to the instances
+    auto numOutputs = output.size(1);
+    const auto *rows = output.data_ptr<float>();
+    const juce::ScopedLock callbackLock(mCallbackLock);
+    for (size_t i = 0; i < numRequests; i++)
+    {
+        {
+            const juce::ScopedLock lock(mLock);
+            if (std::find(
+                    mCancelled.begin(),
+                    mCancelled.end(),
+                    requests[i].owner
+                ) != mCancelled.end())
+            {
+                continue;
+            }
+        }
+
+        const auto *row = rows + int64_t(i) * numOutputs;
+        requests[i].callback(std::vector<float>(row, row + numOutputs));
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <torch/script.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "TaskExecutor.h"
+
+/**
+ * @brief  Process wide service that batches the fc forwards of all
+ * instances
+ * @note   When many instances predict at once, for example under a shared
+ * automation macro, their requests are collected for up to a short window
+ * and evaluated as one batched forward per model, then scattered back
+ * through the callbacks. Requests of networks with the same model hash
+ * share a forward. Only the latest request of an instance is kept while it
+ * waits. Shared through juce::SharedResourcePointer, the window is a
+ * delayed job on the shared TaskExecutor and the forwards and callbacks
+ * run on its interactive strand.
+ */
+class InferenceBatcher
+{
+public:
+    using Callback = std::function<void(const std::vector<float>& output)>;
+
+    InferenceBatcher();
+    ~InferenceBatcher();
+
+    /**
+     * @brief  Queue a forward of a network for one input row
+     * @param  owner: the submitting instance, see cancel
+     * @param  modelHash: hash of the model file, requests with the same hash
+     * are evaluated with the network of one of them
+     * @param  network: the network, in eval mode
+     * @param  input: the input row
+     * @param  callback: receives the output row, on the batcher strand
+     */
+    void submit(
+        const void* owner,
+        uint64_t modelHash,
+        const torch::jit::Module& network,
+        std::vector<float> input,
+        Callback callback
+    );
+
+    /**
+     * @brief  Drop the requests of an owner
+     * @note   Waits for a running callback of the owner, so the owner can
+     * be destroyed afterwards
+     */
+    void cancel(const void* owner);
+
+    /**
+     * @brief  How long requests are collected after the first one arrives
+     */
+    void setWindow(double milliseconds);
+
+    /**
+     * @brief  A batch of this size starts without waiting for the window
+     */
+    void setMaxBatchSize(int maxBatchSize);
+
+    uint64_t getNumBatches() const;
+    uint64_t getNumRequests() const;
+
+private:
+    struct Request
+    {
+        const void* owner = nullptr;
+        uint64_t modelHash = 0;
+        torch::jit::Module network;
+        std::vector<float> input;
+        Callback callback;
+    };
+
+    /**
+     * @brief  Evaluate the pending requests, on the strand
+     */
+    void flush();
+
+    /**
+     * @brief  One forward per model and chunk of at most mMaxBatchSize
+     */
+    void runBatches(std::vector<Request>& requests);
+    void runBatch(Request* requests, size_t numRequests);
+
+private:
+    juce::CriticalSection mLock;
+    std::vector<Request> mPending;
+    // owners cancelled while their batch was running
+    std::vector<const void*> mCancelled;
+    bool mBatchRunning = false;
+    // a flush waits for the window, under mLock
+    bool mFlushScheduled = false;
+
+    // held while the callbacks of a batch run
+    juce::CriticalSection mCallbackLock;
+
+    std::atomic<double> mWindowMs{1.0};
+    std::atomic<int> mMaxBatchSize{64};
+    std::atomic<uint64_t> mNumBatches{0};
+    std::atomic<uint64_t> mNumRequests{0};
+
+    // last, so no flush runs on a half destroyed batcher
+    TaskStrand mStrand{"inference_batcher", TaskPriority::Interactive};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(InferenceBatcher)
+};
@@ -0,0 +1,341 @@
+#include "InferenceCache.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+InferenceCache::Key::Key(Kind kind)
+    : mKind(kind)
+{
+}
+
+void InferenceCache::Key::append(uint64_t value)
+{
+    mValues.push_back(int32_t(uint32_t(value)));
+    mValues.push_back(int32_t(uint32_t(value >> 32)));
+}
+
+void InferenceCache::Key::appendQuantized(
+    const float *values,
+    size_t numValues,
+    float step
+)
+{
+    mValues.push_back(int32_t(numValues));
+    for (size_t i = 0; i < numValues; i++)
+    {
+        mValues.push_back(int32_t(std::lround(values[i] / step)));
+    }
+}
+
+uint64_t InferenceCache::Key::getHash() const
+{
+    auto kind = uint32_t(mKind);
+    auto seed = InferenceCache::hash(&kind, sizeof(kind));
+    return InferenceCache::hash(
+        mValues.data(),
+        mValues.size() * sizeof(int32_t),
+        seed
+    );
+}
+
+InferenceCache::InferenceCache()
+    : InferenceCache(getDefaultDirectory(), kDefaultMaxBytes)
+{
+}
+
+InferenceCache::InferenceCache(const juce::File &directory, int64_t maxBytes)
+    : mDirectory(directory)
+    , mMaxBytes(maxBytes)
+{
+    // a lookup before the scan is a miss at worst
+    mStrand.post([this] { scan(); });
+}
+
+InferenceCache::~InferenceCache()
+{
+    mStrand.stop();
+    const juce::ScopedLock lock(mLock);
+    touchHitEntries();
+}
+
+juce::File InferenceCache::getDefaultDirectory()
+{
+    return juce::File::getSpecialLocation(
+               juce::File::SpecialLocationType::userApplicationDataDirectory
+    )
+        .getChildFile("NeuralResonatorVST")
+        .getChildFile("cache");
+}
+
+uint64_t InferenceCache::hash(
+    const void *data,
+    size_t numBytes,
+    uint64_t seed
+)
+{
+    auto bytes = static_cast<const uint8_t *>(data);
+    uint64_t result = seed;
+    for (size_t i = 0; i < numBytes; i++)
+    {
+        result ^= bytes[i];
+        result *= 1099511628211ull;
+    }
+    return result;
+}
+
+bool InferenceCache::hashFile(const juce::File &file, uint64_t &result)
+{
+    juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+    if (mapped.getData() == nullptr)
+    {
+        auto path = file.getFullPathName().toStdString();
+        result = hash(path.data(), path.size());
+        JLOG("Inference cache: can not hash " + file.getFullPathName());
+        return false;
+    }
+    result = hash(mapped.getData(), mapped.getSize());
+    return true;
+}
+
+bool InferenceCache::lookup(const Key &key, float *dest, size_t numValues)
+{
+    const juce::ScopedLock lock(mLock);
+
+    auto file = getEntryFile(key);
+    if (!file.existsAsFile())
+    {
+        mNumMisses++;
+        return false;
+    }
+
+    const auto &keyValues = key.getValues();
+    size_t expectedSize = sizeof(Header) +
+                          keyValues.size() * sizeof(int32_t) +
+                          numValues * sizeof(float);
+
+    bool valid = false;
+    bool stale = false;
+    {
+        juce::MemoryMappedFile mapped(file, juce::MemoryMappedFile::readOnly);
+        auto data = static_cast<const char *>(mapped.getData());
+
+        // written by another version of the format, it will never hit
+        if (data != nullptr && mapped.getSize() >= sizeof(Header))
+        {
+            Header header;
+            std::memcpy(&header, data, sizeof(Header));
+            stale = header.magic != kMagic ||
+                    header.version != kFormatVersion;
+        }
+
+        if (!stale && data != nullptr && mapped.getSize() == expectedSize)
+        {
+            Header header;
+            std::memcpy(&header, data, sizeof(Header));
+            auto keyData = data + sizeof(Header);
+            auto valueData = keyData + keyValues.size() * sizeof(int32_t);
+
+            valid = header.magic == kMagic &&
+                    header.version == kFormatVersion &&
+                    header.kind == uint32_t(key.getKind()) &&
+                    header.numKeyValues == keyValues.size() &&
+                    header.numValues == numValues &&
+                    std::memcmp(
+                        keyData,
+                        keyValues.data(),
+                        keyValues.size() * sizeof(int32_t)
+                    ) == 0;
+
+            if (valid)
+            {
+                std::memcpy(dest, valueData, numValues * sizeof(float));
+            }
+        }
+    }
+
+    if (!valid)
+    {
+        // an old version, a truncated file or a collision
+        if (stale)
+        {
+            auto size = file.getSize();
+            if (file.deleteFile()) { mTotalBytes -= size; }
+        }
+        mNumMisses++;
+        return false;
+    }
+
+    // refreshed for the eviction order by the next store, which runs in
+    // the background
+    mHitEntries.addIfNotAlreadyThere(file.getFullPathName());
+    mNumHits++;
+    return true;
+}
+
+void InferenceCache::store(
+    const Key &key,
+    const float *values,
+    size_t numValues
+)
+{
+    const juce::ScopedLock lock(mLock);
+    const auto &keyValues = key.getValues();
+
+    Header header;
+    header.magic = kMagic;
+    header.version = kFormatVersion;
+    header.kind = uint32_t(key.getKind());
+    header.numKeyValues = uint32_t(keyValues.size());
+    header.numValues = uint32_t(numValues);
+
+    touchHitEntries();
+
+    auto file = getEntryFile(key);
+    auto previousSize = file.existsAsFile() ? file.getSize() : 0;
+
+    // unique, other processes may write the same entry at the same time
+    auto temporary = mDirectory.getChildFile(
+        file.getFileNameWithoutExtension() + "_" + juce::Uuid().toString() +
+        ".tmp"
+    );
+    {
+        juce::FileOutputStream stream(temporary);
+        if (!stream.openedOk())
+        {
+            JLOG("Inference cache: can not write " + temporary.getFileName());
+            return;
+        }
+        stream.setPosition(0);
+        stream.truncate();
+
+        bool written =
+            stream.write(&header, sizeof(Header)) &&
+            stream.write(
+                keyValues.data(),
+                keyValues.size() * sizeof(int32_t)
+            ) &&
+            stream.write(values, numValues * sizeof(float));
+        stream.flush();
+
+        if (!written)
+        {
+            JLOG("Inference cache: can not write " + temporary.getFileName());
+            temporary.deleteFile();
+            return;
+        }
+    }
+
+    if (!temporary.moveFileTo(file))
+    {
+        temporary.deleteFile();
+        return;
+    }
+
+    mTotalBytes += file.getSize() - previousSize;
+    if (mTotalBytes > mMaxBytes) { evict(); }
+}
+
+void InferenceCache::clear()
+{
+    const juce::ScopedLock lock(mLock);
+    for (auto &entry : findEntries()) { entry.deleteFile(); }
+    mTotalBytes = 0;
+    mHitEntries.clear();
+}
+
+int64_t InferenceCache::getTotalBytes() const
+{
+    const juce::ScopedLock lock(mLock);
+    return mTotalBytes;
+}
+
+uint64_t InferenceCache::getNumHits() const
+{
+    return mNumHits;
+}
+
+uint64_t InferenceCache::getNumMisses() const
+{
+    return mNumMisses;
+}
+
+juce::File InferenceCache::getEntryFile(const Key &key) const
+{
+    return mDirectory.getChildFile(
+        juce::String::toHexString(juce::int64(key.getHash())) + ".bin"
+    );
+}
+
+juce::Array<juce::File> InferenceCache::findEntries() const
+{
+    return mDirectory.findChildFiles(
+        juce::File::findFiles,
+        false,
+        "*.bin"
+    );
+}
+
+void InferenceCache::scan()
+{
+    const juce::ScopedLock lock(mLock);
+    mDirectory.createDirectory();
+
+    // the stores before the scan are part of the sum
+    mTotalBytes = 0;
+    for (const auto &entry : findEntries())
+    {
+        mTotalBytes += entry.getSize();
+    }
+
+    JLOG(
+        "Inference cache: " + mDirectory.getFullPathName() + ", " +
+        juce::String(mTotalBytes) + " bytes"
+    );
+    evict();
+}
+
+void InferenceCache::touchHitEntries()
+{
+    auto now = juce::Time::getCurrentTime();
+    for (const auto &path : mHitEntries)
+    {
+        juce::File entry(path);
+        if (entry.existsAsFile()) { entry.setLastModificationTime(now); }
+    }
+    mHitEntries.clear();
+}
+
+void InferenceCache::evict()
+{
+    if (mTotalBytes <= mMaxBytes) { return; }
+
+    // every stat is a system call, each entry is read once before sorting
+    struct Entry
+    {
+        juce::Time time;
+        int64_t size;
+        juce::File file;
+    };
+    std::vector<Entry> entries;
+    mTotalBytes = 0;
+    for (auto &file : findEntries())
+    {
+        auto size = file.getSize();
+        entries.push_back({file.getLastModificationTime(), size, file});
+        mTotalBytes += size;
+    }
+    std::sort(
+        entries.begin(),
+        entries.end(),
+        [](const Entry &a, const Entry &b) { return a.time < b.time; }
+    );
+
+    // evict down to 90% so not every store has to scan the directory
+    auto target = mMaxBytes - mMaxBytes / 10;
+    for (auto &entry : entries)
+    {
+        if (mTotalBytes <= target) { break; }
+        if (entry.file.deleteFile()) { mTotalBytes -= entry.size; }
+    }
+}
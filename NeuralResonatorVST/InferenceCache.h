@@ -0,0 +1,167 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+#include "TaskExecutor.h"
+
+/**
+ * @brief  Persistent cache of encoder features and coefficient frames
+ * @note   Every entry is a small file named after the hash of its key, so
+ * features and coefficients survive a restart and a recalled shape or
+ * preset is a lookup instead of an inference. Entries are read through
+ * juce::MemoryMappedFile and written to a temporary file that is moved in
+ * place, so a crash never leaves a partial entry behind. The full key is
+ * stored in the entry and compared on lookup, so a hash collision is a
+ * miss. The total size is limited, the least recently used entries (by
+ * modification time, refreshed for the hits on the next store) are
+ * evicted first.
+ * All instances share one cache through juce::SharedResourcePointer,
+ * every call is serialised. The directory is scanned on a background
+ * strand, so constructing the cache does not touch the disk.
+ */
+class InferenceCache
+{
+public:
+    enum class Kind : uint32_t
+    {
+        Features = 1,
+        Coefficients = 2
+    };
+
+    // bump when the entry layout or the key layout changes, entries of
+    // other versions are treated as misses and removed
+    static constexpr uint32_t kFormatVersion = 1;
+
+    static constexpr int64_t kDefaultMaxBytes = 64 * 1024 * 1024;
+
+    /**
+     * @brief  Key material of one entry
+     */
+    class Key
+    {
+    public:
+        explicit Key(Kind kind);
+
+        Kind getKind() const { return mKind; }
+        const std::vector<int32_t>& getValues() const { return mValues; }
+
+        void append(uint64_t value);
+
+        /**
+         * @brief  Append values rounded to a multiple of step
+         */
+        void appendQuantized(
+            const float* values,
+            size_t numValues,
+            float step
+        );
+
+        uint64_t getHash() const;
+
+    private:
+        Kind mKind;
+        std::vector<int32_t> mValues;
+    };
+
+    /**
+     * @brief  The cache in the default directory, see getDefaultDirectory
+     */
+    InferenceCache();
+
+    /**
+     * @param  directory: where the entries are stored, created if needed
+     * @param  maxBytes: size limit of all entries together
+     */
+    InferenceCache(const juce::File& directory, int64_t maxBytes);
+    ~InferenceCache();
+
+    /**
+     * @brief  The cache directory in the user application data directory
+     */
+    static juce::File getDefaultDirectory();
+
+    /**
+     * @brief  64 bit FNV-1a hash
+     */
+    static uint64_t hash(
+        const void* data,
+        size_t numBytes,
+        uint64_t seed = 14695981039346656037ull
+    );
+
+    /**
+     * @brief  Hash of the contents of a file
+     * @note   If the file can not be read the hash is derived from its
+     * path, so different models still get different hashes, but nothing
+     * keyed by it may be cached since the contents may change
+     * @retval false if the file can not be read
+     */
+    static bool hashFile(const juce::File& file, uint64_t& hash);
+
+    /**
+     * @brief  Look up an entry
+     * @param  key: the key of the entry
+     * @param  dest: numValues floats, only written on a hit
+     * @param  numValues: expected number of values
+     * @retval true on a hit
+     */
+    bool lookup(const Key& key, float* dest, size_t numValues);
+
+    /**
+     * @brief  Store an entry, evicting old entries if the size limit is
+     * exceeded
+     */
+    void store(const Key& key, const float* values, size_t numValues);
+
+    /**
+     * @brief  Remove all entries
+     */
+    void clear();
+
+    int64_t getTotalBytes() const;
+    uint64_t getNumHits() const;
+    uint64_t getNumMisses() const;
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t kind;
+        uint32_t numKeyValues;
+        uint32_t numValues;
+    };
+
+    static constexpr uint32_t kMagic = 0x3143524e;  // "NRC1"
+
+    juce::File getEntryFile(const Key& key) const;
+    juce::Array<juce::File> findEntries() const;
+
+    /**
+     * @brief  Create the directory and sum up the size of its entries, on
+     * the strand
+     */
+    void scan();
+    void evict();
+
+    /**
+     * @brief  Refresh the modification time of the entries hit since the
+     * last call
+     */
+    void touchHitEntries();
+
+private:
+    juce::CriticalSection mLock;
+    juce::File mDirectory;
+    int64_t mMaxBytes;
+    int64_t mTotalBytes = 0;
+    // a hit only records the entry, the lookup stays free of disk writes
+    juce::StringArray mHitEntries;
+
+    std::atomic<uint64_t> mNumHits{0};
+    std::atomic<uint64_t> mNumMisses{0};
+
+    TaskStrand mStrand{"inference_cache", TaskPriority::Background};
+};
@@ -0,0 +1,250 @@
+#include "InferenceTelemetry.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <cmath>
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (auto &bucket : mBuckets) { bucket = 0; }
+}
+
+void LatencyHistogram::record(double microseconds)
+{
+    // bucket 0 holds everything below 1 us
+    int bucket = 0;
+    if (microseconds >= 1.0)
+    {
+        bucket = 1 + int(std::log2(microseconds) * kBucketsPerOctave);
+        bucket = std::min(bucket, kNumBuckets - 1);
+    }
+
+    mBuckets[size_t(bucket)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mTotalNanoseconds.fetch_add(
+        uint64_t(std::max(microseconds, 0.0) * 1e3),
+        std::memory_order_relaxed
+    );
+
+    double max = mMax.load(std::memory_order_relaxed);
+    while (microseconds > max &&
+           !mMax.compare_exchange_weak(
+               max,
+               microseconds,
+               std::memory_order_relaxed
+           ))
+    {
+    }
+}
+
+void LatencyHistogram::reset()
+{
+    for (auto &bucket : mBuckets) { bucket.store(0); }
+    mCount = 0;
+    mTotalNanoseconds = 0;
+    mMax = 0.0;
+}
+
+uint64_t LatencyHistogram::getCount() const
+{
+    return mCount;
+}
+
+double LatencyHistogram::getMax() const
+{
+    return mMax;
+}
+
+double LatencyHistogram::getTotal() const
+{
+    return double(mTotalNanoseconds.load()) * 1e-3;
+}
+
+double LatencyHistogram::getPercentile(double quantile) const
+{
+    // sum the buckets instead of using mCount, so a concurrent record can
+    // not push the target past the last bucket
+    uint64_t total = 0;
+    for (const auto &bucket : mBuckets)
+    {
+        total += bucket.load(std::memory_order_relaxed);
+    }
+    if (total == 0) { return 0.0; }
+
+    auto target = uint64_t(std::ceil(quantile * double(total)));
+    target = std::max<uint64_t>(target, 1);
+
+    uint64_t cumulative = 0;
+    for (int i = 0; i < kNumBuckets; i++)
+    {
+        cumulative += mBuckets[size_t(i)].load(std::memory_order_relaxed);
+        if (cumulative >= target)
+        {
+            return std::min(getBucketUpperEdge(i), getMax());
+        }
+    }
+    return getMax();
+}
+
+double LatencyHistogram::getBucketUpperEdge(int bucket)
+{
+    return std::exp2(double(bucket) / kBucketsPerOctave);
+}
+
+InferenceTelemetry::InferenceTelemetry()
+{
+    mLastSummaryTicks = now();
+}
+
+const char *InferenceTelemetry::getStageName(Stage stage)
+{
+    switch (stage)
+    {
+    case Stage::ShapeToRaster: return "shape -> raster";
+    case Stage::EncoderForward: return "encoder forward";
+    case Stage::FCForward: return "fc forward";
+    case Stage::Handoff: return "handoff";
+    case Stage::AudioPickup: return "audio pickup";
+    default: return "unknown";
+    }
+}
+
+const char *InferenceTelemetry::getLaneName(Lane lane)
+{
+    switch (lane)
+    {
+    case Lane::Encoder: return "encoder";
+    case Lane::FC: return "fc";
+    default: return "unknown";
+    }
+}
+
+int64_t InferenceTelemetry::now()
+{
+    return juce::Time::getHighResolutionTicks();
+}
+
+void InferenceTelemetry::record(Stage stage, int64_t startTicks)
+{
+    recordMicroseconds(
+        stage,
+        juce::Time::highResolutionTicksToSeconds(now() - startTicks) * 1e6
+    );
+}
+
+void InferenceTelemetry::recordMicroseconds(Stage stage, double microseconds)
+{
+    mHistograms[size_t(stage)].record(microseconds);
+}
+
+InferenceTelemetry::Summary InferenceTelemetry::getSummary(Stage stage) const
+{
+    const auto &histogram = mHistograms[size_t(stage)];
+
+    Summary summary;
+    summary.count = histogram.getCount();
+    summary.total = histogram.getTotal();
+    summary.p50 = histogram.getPercentile(0.50);
+    summary.p95 = histogram.getPercentile(0.95);
+    summary.p99 = histogram.getPercentile(0.99);
+    summary.max = histogram.getMax();
+    return summary;
+}
+
+void InferenceTelemetry::jobQueued(Lane lane)
+{
+    auto &counters = mLanes[size_t(lane)];
+    int depth = ++counters.queueDepth;
+
+    int max = counters.maxQueueDepth.load(std::memory_order_relaxed);
+    while (depth > max &&
+           !counters.maxQueueDepth.compare_exchange_weak(max, depth))
+    {
+    }
+}
+
+void InferenceTelemetry::jobStarted(Lane lane)
+{
+    mLanes[size_t(lane)].queueDepth--;
+}
+
+void InferenceTelemetry::jobCancelled(Lane lane)
+{
+    mLanes[size_t(lane)].numCancelled++;
+}
+
+InferenceTelemetry::LaneSummary InferenceTelemetry::getLaneSummary(Lane lane
+) const
+{
+    const auto &counters = mLanes[size_t(lane)];
+
+    LaneSummary summary;
+    summary.queueDepth = counters.queueDepth;
+    summary.maxQueueDepth = counters.maxQueueDepth;
+    summary.numCancelled = counters.numCancelled;
+    return summary;
+}
+
+juce::String InferenceTelemetry::getSummaryString() const
+{
+    juce::String result = "Inference latency (us):";
+    for (int i = 0; i < kNumStages; i++)
+    {
+        auto stage = Stage(i);
+        auto summary = getSummary(stage);
+        result << "\n  "
+               << juce::String(getStageName(stage)).paddedRight(' ', 17)
+               << " n=" << juce::String(juce::uint64(summary.count))
+               << " p50=" << juce::String(summary.p50, 1)
+               << " p95=" << juce::String(summary.p95, 1)
+               << " p99=" << juce::String(summary.p99, 1)
+               << " max=" << juce::String(summary.max, 1);
+    }
+    for (int i = 0; i < kNumLanes; i++)
+    {
+        auto lane = Lane(i);
+        auto summary = getLaneSummary(lane);
+        result << "\n  "
+               << (juce::String(getLaneName(lane)) + " queue")
+                      .paddedRight(' ', 17)
+               << " depth=" << summary.queueDepth
+               << " max=" << summary.maxQueueDepth << " cancelled="
+               << juce::String(juce::uint64(summary.numCancelled));
+    }
+    return result;
+}
+
+void InferenceTelemetry::reset()
+{
+    for (auto &histogram : mHistograms) { histogram.reset(); }
+    for (auto &lane : mLanes)
+    {
+        lane.maxQueueDepth = lane.queueDepth.load();
+        lane.numCancelled = 0;
+    }
+    mLastSummaryCount = 0;
+}
+
+void InferenceTelemetry::setSummaryInterval(double seconds)
+{
+    mSummaryIntervalSeconds = seconds;
+}
+
+void InferenceTelemetry::logSummaryIfDue()
+{
+    auto currentTicks = now();
+    auto elapsed = juce::Time::highResolutionTicksToSeconds(
+        currentTicks - mLastSummaryTicks
+    );
+    if (elapsed < mSummaryIntervalSeconds) { return; }
+
+    uint64_t count = 0;
+    for (const auto &histogram : mHistograms)
+    {
+        count += histogram.getCount();
+    }
+    if (count == mLastSummaryCount) { return; }
+
+    mLastSummaryTicks = currentTicks;
+    mLastSummaryCount = count;
+    JLOG(getSummaryString());
+}
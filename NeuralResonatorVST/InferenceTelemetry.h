@@ -0,0 +1,183 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+/**
+ * @brief  Lock-free latency histogram with logarithmic buckets
+ * @note   Every octave of microseconds is split into kBucketsPerOctave
+ * buckets, so percentiles are resolved to about 9%. Recording only touches
+ * atomics and can be done from any thread, including the audio thread.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr int kBucketsPerOctave = 8;
+    // 1 us to 2^24 us (~17 s)
+    static constexpr int kNumOctaves = 24;
+    static constexpr int kNumBuckets = kBucketsPerOctave * kNumOctaves + 1;
+
+    LatencyHistogram();
+
+    void record(double microseconds);
+
+    /**
+     * @brief  Clear the histogram
+     * @note   Not atomic with respect to concurrent calls to record, a
+     * measurement recorded during a reset may be partially kept
+     */
+    void reset();
+
+    uint64_t getCount() const;
+    double getMax() const;
+
+    /**
+     * @brief  Sum of all recorded latencies in microseconds, the mean over
+     * an interval follows from the change of total and count
+     */
+    double getTotal() const;
+
+    /**
+     * @brief  Upper edge of the bucket holding the given quantile
+     * @param  quantile: in [0, 1]
+     * @retval the latency in microseconds, or 0 if nothing was recorded
+     */
+    double getPercentile(double quantile) const;
+
+private:
+    static double getBucketUpperEdge(int bucket);
+
+private:
+    std::array<std::atomic<uint32_t>, kNumBuckets> mBuckets;
+    std::atomic<uint64_t> mCount{0};
+    std::atomic<uint64_t> mTotalNanoseconds{0};
+    std::atomic<double> mMax{0.0};
+};
+
+/**
+ * @brief  Per instance latency histograms of the inference pipeline
+ * @note   The stages follow a new shape or parameter change from the ui to
+ * the audio thread. A summary is written to the log at most once per
+ * summary interval, from the processor thread.
+ */
+class InferenceTelemetry
+{
+public:
+    enum class Stage
+    {
+        // rasterization into the encoder input
+        ShapeToRaster,
+        // encoder forward, including the feature copy and cached fc prefix
+        EncoderForward,
+        // fc forward on the torch thread or on the audio thread
+        FCForward,
+        // coefficentsChanged until the coefficients reach the filterbank
+        Handoff,
+        // filterbank update until the next processBlock
+        AudioPickup,
+        NumStages
+    };
+
+    /**
+     * @brief  Worker queues of the pipeline
+     */
+    enum class Lane
+    {
+        // rasterize and encode
+        Encoder,
+        // predict and publish
+        FC,
+        NumLanes
+    };
+
+    struct LaneSummary
+    {
+        int queueDepth = 0;
+        int maxQueueDepth = 0;
+        uint64_t numCancelled = 0;
+    };
+
+    struct Summary
+    {
+        uint64_t count = 0;
+        double total = 0.0;
+        double p50 = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+        double max = 0.0;
+    };
+
+    static constexpr int kNumStages = int(Stage::NumStages);
+    static constexpr int kNumLanes = int(Lane::NumLanes);
+
+    InferenceTelemetry();
+
+    static const char* getStageName(Stage stage);
+    static const char* getLaneName(Lane lane);
+
+    /**
+     * @brief  Current time in high resolution ticks, for use with record
+     */
+    static int64_t now();
+
+    /**
+     * @brief  Record the time elapsed since startTicks
+     * @param  stage: the stage to record into
+     * @param  startTicks: a value returned by now()
+     */
+    void record(Stage stage, int64_t startTicks);
+    void recordMicroseconds(Stage stage, double microseconds);
+
+    Summary getSummary(Stage stage) const;
+
+    /**
+     * @brief  Count a job posted to a lane
+     */
+    void jobQueued(Lane lane);
+
+    /**
+     * @brief  Count a job taken from a lane, cancelled or not
+     */
+    void jobStarted(Lane lane);
+
+    /**
+     * @brief  Count a job dropped because a newer one superseded it
+     */
+    void jobCancelled(Lane lane);
+
+    LaneSummary getLaneSummary(Lane lane) const;
+
+    /**
+     * @brief  One line per stage with count, p50, p95, p99 and max in
+     * microseconds, and one line per lane with its queue depth and number of
+     * cancelled jobs
+     */
+    juce::String getSummaryString() const;
+
+    void reset();
+
+    void setSummaryInterval(double seconds);
+
+    /**
+     * @brief  Log the summary if the summary interval has elapsed since the
+     * last one and something was recorded in between
+     */
+    void logSummaryIfDue();
+
+private:
+    std::array<LatencyHistogram, kNumStages> mHistograms;
+
+    struct LaneCounters
+    {
+        std::atomic<int> queueDepth{0};
+        std::atomic<int> maxQueueDepth{0};
+        std::atomic<uint64_t> numCancelled{0};
+    };
+    std::array<LaneCounters, kNumLanes> mLanes;
+
+    std::atomic<double> mSummaryIntervalSeconds{30.0};
+    std::atomic<int64_t> mLastSummaryTicks{0};
+    std::atomic<uint64_t> mLastSummaryCount{0};
+};
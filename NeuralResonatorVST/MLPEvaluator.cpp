@@ -0,0 +1,483 @@
+#include "MLPEvaluator.h"
+#include "HelperFunctions.h"
+#include <torch/csrc/jit/ir/ir.h>
+#include <torch/csrc/jit/ir/constants.h>
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define MLP_USE_SSE 1
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define MLP_USE_NEON 1
+#endif
+
+namespace
+{
+/**
+ * @brief  y[r] = init[r] + sum_c weights[r * stride + c] * x[c]
+ * @note   Four rows are processed at a time so every load of x is shared,
+ * the remaining rows and columns are handled in scalar code.
+ */
+void gemv(
+    const float* weights,
+    int stride,
+    int numRows,
+    int numCols,
+    const float* x,
+    const float* init,
+    float* y
+)
+{
+    int r = 0;
+#if MLP_USE_SSE
+    for (; r + 4 <= numRows; r += 4)
+    {
+        const float* w0 = weights + r * stride;
+        const float* w1 = w0 + stride;
+        const float* w2 = w1 + stride;
+        const float* w3 = w2 + stride;
+
+        __m128 acc0 = _mm_setzero_ps();
+        __m128 acc1 = _mm_setzero_ps();
+        __m128 acc2 = _mm_setzero_ps();
+        __m128 acc3 = _mm_setzero_ps();
+
+        int c = 0;
+        for (; c + 4 <= numCols; c += 4)
+        {
+            __m128 xv = _mm_loadu_ps(x + c);
+            acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(w0 + c), xv));
+            acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(w1 + c), xv));
+            acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(w2 + c), xv));
+            acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(w3 + c), xv));
+        }
+
+        // horizontal sums of the four accumulators in one register
+        _MM_TRANSPOSE4_PS(acc0, acc1, acc2, acc3);
+        __m128 sum =
+            _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+        float sums[4];
+        _mm_storeu_ps(sums, sum);
+
+        for (; c < numCols; c++)
+        {
+            sums[0] += w0[c] * x[c];
+            sums[1] += w1[c] * x[c];
+            sums[2] += w2[c] * x[c];
+            sums[3] += w3[c] * x[c];
+        }
+
+        for (int k = 0; k < 4; k++) { y[r + k] = init[r + k] + sums[k]; }
+    }
+#elif MLP_USE_NEON
+    for (; r + 4 <= numRows; r += 4)
+    {
+        const float* w0 = weights + r * stride;
+        const float* w1 = w0 + stride;
+        const float* w2 = w1 + stride;
+        const float* w3 = w2 + stride;
+
+        float32x4_t acc0 = vdupq_n_f32(0.0f);
+        float32x4_t acc1 = vdupq_n_f32(0.0f);
+        float32x4_t acc2 = vdupq_n_f32(0.0f);
+        float32x4_t acc3 = vdupq_n_f32(0.0f);
+
+        int c = 0;
+        for (; c + 4 <= numCols; c += 4)
+        {
+            float32x4_t xv = vld1q_f32(x + c);
+            acc0 = vfmaq_f32(acc0, vld1q_f32(w0 + c), xv);
+            acc1 = vfmaq_f32(acc1, vld1q_f32(w1 + c), xv);
+            acc2 = vfmaq_f32(acc2, vld1q_f32(w2 + c), xv);
+            acc3 = vfmaq_f32(acc3, vld1q_f32(w3 + c), xv);
+        }
+
+        float sums[4] = {
+            vaddvq_f32(acc0),
+            vaddvq_f32(acc1),
+            vaddvq_f32(acc2),
+            vaddvq_f32(acc3)};
+
+        for (; c < numCols; c++)
+        {
+            sums[0] += w0[c] * x[c];
+            sums[1] += w1[c] * x[c];
+            sums[2] += w2[c] * x[c];
+            sums[3] += w3[c] * x[c];
+        }
+
+        for (int k = 0; k < 4; k++) { y[r + k] = init[r + k] + sums[k]; }
+    }
+#endif
+    for (; r < numRows; r++)
+    {
+        const float* w = weights + r * stride;
+        float sum = 0.0f;
+        for (int c = 0; c < numCols; c++) { sum += w[c] * x[c]; }
+        y[r] = init[r] + sum;
+    }
+}
+
+std::vector<float> tensorToVector(const at::Tensor& tensor)
+{
+    auto contiguous = tensor.to(at::kFloat).contiguous();
+    const float* data = contiguous.data_ptr<float>();
+    return std::vector<float>(data, data + contiguous.numel());
+}
+}  // namespace
+
+MLPEvaluator::MLPEvaluator(std::vector<Layer> layers)
+    : mLayers(std::move(layers))
+{
+    for (const auto& layer : mLayers)
+    {
+        mMaxWidth = std::max(mMaxWidth, layer.numOutputs);
+    }
+}
+
+std::unique_ptr<MLPEvaluator> MLPEvaluator::fromModule(
+    const torch::jit::Module& module
+)
+{
+    using torch::jit::Value;
+
+    // freezing inlines the submodules and turns the parameters into
+    // constants, so the forward graph is a flat list of ops
+    torch::jit::Module frozen;
+    try
+    {
+        frozen = torch::jit::freeze(
+            module,
+            c10::nullopt,
+            /*optimize_numerics=*/false
+        );
+    }
+    catch (const c10::Error& e)
+    {
+        JLOG(
+            "MLPEvaluator: cannot freeze the module: " + std::string(e.what())
+        );
+        return nullptr;
+    }
+
+    auto graph = frozen.get_method("forward").graph();
+    if (graph->inputs().size() != 2 || graph->outputs().size() != 1)
+    {
+        JLOG("MLPEvaluator: forward must take and return a single tensor");
+        return nullptr;
+    }
+
+    // constants derived from other constants (e.g. transposed weights)
+    std::unordered_map<const Value*, at::Tensor> derivedConstants;
+    auto constantTensor =
+        [&](const Value* value) -> c10::optional<at::Tensor>
+    {
+        auto it = derivedConstants.find(value);
+        if (it != derivedConstants.end()) { return it->second; }
+        auto ivalue = torch::jit::toIValue(value);
+        if (ivalue && ivalue->isTensor()) { return ivalue->toTensor(); }
+        return c10::nullopt;
+    };
+    auto isNone = [](const Value* value)
+    {
+        auto ivalue = torch::jit::toIValue(value);
+        return ivalue && ivalue->isNone();
+    };
+
+    const Value* current = graph->inputs()[1];
+    std::vector<Layer> layers;
+
+    auto addLayer = [&](const at::Tensor& weight, const at::Tensor& bias)
+    {
+        Layer layer;
+        layer.numOutputs = int(weight.size(0));
+        layer.numInputs = int(weight.size(1));
+        layer.weights = tensorToVector(weight);
+        layer.bias = bias.defined()
+                       ? tensorToVector(bias)
+                       : std::vector<float>(size_t(layer.numOutputs), 0.0f);
+        layers.push_back(std::move(layer));
+    };
+
+    auto unsupported = [](const torch::jit::Node* node)
+    {
+        JLOG(
+            "MLPEvaluator: unsupported op " +
+            std::string(node->kind().toQualString())
+        );
+        return nullptr;
+    };
+
+    for (auto* node : graph->nodes())
+    {
+        auto kind = node->kind();
+
+        if (kind == c10::prim::Constant || kind == c10::prim::ListConstruct)
+        {
+            continue;
+        }
+
+        if (kind == c10::aten::t || kind == c10::aten::transpose)
+        {
+            // only transposes of constant weights are supported
+            auto weight = constantTensor(node->input(0));
+            if (!weight || weight->dim() != 2) { return unsupported(node); }
+            derivedConstants[node->output()] = weight->t();
+            continue;
+        }
+
+        if (kind == c10::aten::linear)
+        {
+            auto weight = constantTensor(node->input(1));
+            auto bias = constantTensor(node->input(2));
+            if (node->input(0) != current || !weight || weight->dim() != 2 ||
+                (!bias && !isNone(node->input(2))))
+            {
+                return unsupported(node);
+            }
+            addLayer(*weight, bias ? bias->reshape({-1}) : at::Tensor());
+            current = node->output();
+            continue;
+        }
+
+        if (kind == c10::aten::addmm)
+        {
+            // bias + input @ weight.t(), as traced by older versions
+            auto bias = constantTensor(node->input(0));
+            auto transposed = constantTensor(node->input(2));
+            auto beta = torch::jit::toIValue(node->input(3));
+            auto alpha = torch::jit::toIValue(node->input(4));
+            if (node->input(1) != current || !bias || !transposed ||
+                transposed->dim() != 2 || !beta || !alpha ||
+                beta->toScalar().to<float>() != 1.0f ||
+                alpha->toScalar().to<float>() != 1.0f)
+            {
+                return unsupported(node);
+            }
+            addLayer(transposed->t(), bias->reshape({-1}));
+            current = node->output();
+            continue;
+        }
+
+        bool isActivation = kind == c10::aten::relu ||
+                            kind == c10::aten::relu_ ||
+                            kind == c10::aten::leaky_relu ||
+                            kind == c10::aten::leaky_relu_ ||
+                            kind == c10::aten::tanh ||
+                            kind == c10::aten::tanh_ ||
+                            kind == c10::aten::sigmoid ||
+                            kind == c10::aten::sigmoid_;
+        if (isActivation)
+        {
+            if (node->input(0) != current || layers.empty() ||
+                layers.back().activation != Activation::None)
+            {
+                return unsupported(node);
+            }
+
+            auto& layer = layers.back();
+            if (kind == c10::aten::relu || kind == c10::aten::relu_)
+            {
+                layer.activation = Activation::ReLU;
+            }
+            else if (kind == c10::aten::leaky_relu ||
+                     kind == c10::aten::leaky_relu_)
+            {
+                layer.activation = Activation::LeakyReLU;
+                layer.negativeSlope = 0.01f;
+                if (node->inputs().size() > 1)
+                {
+                    auto slope = torch::jit::toIValue(node->input(1));
+                    if (!slope) { return unsupported(node); }
+                    layer.negativeSlope = slope->toScalar().to<float>();
+                }
+            }
+            else if (kind == c10::aten::tanh || kind == c10::aten::tanh_)
+            {
+                layer.activation = Activation::Tanh;
+            }
+            else { layer.activation = Activation::Sigmoid; }
+
+            current = node->output();
+            continue;
+        }
+
+        // ops that do not change the values of a batch of one
+        bool isIdentity = kind == c10::aten::dropout ||
+                          kind == c10::aten::feature_dropout ||
+                          kind == c10::aten::reshape ||
+                          kind == c10::aten::view ||
+                          kind == c10::aten::flatten ||
+                          kind == c10::aten::squeeze ||
+                          kind == c10::aten::unsqueeze ||
+                          kind == c10::aten::contiguous;
+        if (isIdentity && node->input(0) == current)
+        {
+            current = node->output();
+            continue;
+        }
+
+        return unsupported(node);
+    }
+
+    if (graph->outputs()[0] != current || layers.empty())
+    {
+        JLOG("MLPEvaluator: the output is not produced by the layer chain");
+        return nullptr;
+    }
+
+    for (size_t i = 1; i < layers.size(); i++)
+    {
+        if (layers[i].numInputs != layers[i - 1].numOutputs)
+        {
+            JLOG("MLPEvaluator: layer sizes do not match");
+            return nullptr;
+        }
+    }
+
+    JLOG(
+        "MLPEvaluator: extracted " + std::to_string(layers.size()) +
+        " linear layers"
+    );
+    return std::make_unique<MLPEvaluator>(std::move(layers));
+}
+
+int MLPEvaluator::getNumInputs() const
+{
+    return mLayers.front().numInputs;
+}
+
+int MLPEvaluator::getNumOutputs() const
+{
+    return mLayers.back().numOutputs;
+}
+
+int MLPEvaluator::getPrefixSize() const
+{
+    return mLayers.front().numOutputs;
+}
+
+MLPEvaluator::Workspace MLPEvaluator::createWorkspace() const
+{
+    Workspace workspace;
+    workspace.ping.resize(size_t(mMaxWidth));
+    workspace.pong.resize(size_t(mMaxWidth));
+    return workspace;
+}
+
+void MLPEvaluator::forward(
+    const float* input,
+    float* output,
+    Workspace& workspace
+) const
+{
+    forwardLayers(0, input, output, workspace);
+}
+
+void MLPEvaluator::computePrefix(
+    const float* cachedInputs,
+    int numCached,
+    float* prefix
+) const
+{
+    const auto& first = mLayers.front();
+    gemv(
+        first.weights.data(),
+        first.numInputs,
+        first.numOutputs,
+        numCached,
+        cachedInputs,
+        first.bias.data(),
+        prefix
+    );
+}
+
+void MLPEvaluator::forwardWithPrefix(
+    const float* prefix,
+    const float* trailingInputs,
+    int numCached,
+    float* output,
+    Workspace& workspace
+) const
+{
+    const auto& first = mLayers.front();
+    float* hidden = mLayers.size() > 1 ? workspace.ping.data() : output;
+
+    gemv(
+        first.weights.data() + numCached,
+        first.numInputs,
+        first.numOutputs,
+        first.numInputs - numCached,
+        trailingInputs,
+        prefix,
+        hidden
+    );
+    applyActivation(first, hidden);
+
+    if (mLayers.size() > 1) { forwardLayers(1, hidden, output, workspace); }
+}
+
+void MLPEvaluator::forwardLayers(
+    size_t firstLayer,
+    const float* input,
+    float* output,
+    Workspace& workspace
+) const
+{
+    // alternate between the two scratch buffers, the last layer writes
+    // straight into the output
+    const float* x = input;
+    for (size_t i = firstLayer; i < mLayers.size(); i++)
+    {
+        const auto& layer = mLayers[i];
+        float* y = i + 1 == mLayers.size() ? output
+                 : x == workspace.ping.data() ? workspace.pong.data()
+                                              : workspace.ping.data();
+        gemv(
+            layer.weights.data(),
+            layer.numInputs,
+            layer.numOutputs,
+            layer.numInputs,
+            x,
+            layer.bias.data(),
+            y
+        );
+        applyActivation(layer, y);
+        x = y;
+    }
+}
+
+void MLPEvaluator::applyActivation(const Layer& layer, float* values)
+{
+    switch (layer.activation)
+    {
+        case Activation::None: break;
+        case Activation::ReLU:
+            for (int i = 0; i < layer.numOutputs; i++)
+            {
+                values[i] = std::max(values[i], 0.0f);
+            }
+            break;
+        case Activation::LeakyReLU:
+            for (int i = 0; i < layer.numOutputs; i++)
+            {
+                if (values[i] < 0.0f) { values[i] *= layer.negativeSlope; }
+            }
+            break;
+        case Activation::Tanh:
+            for (int i = 0; i < layer.numOutputs; i++)
+            {
+                values[i] = std::tanh(values[i]);
+            }
+            break;
+        case Activation::Sigmoid:
+            for (int i = 0; i < layer.numOutputs; i++)
+            {
+                values[i] = 1.0f / (1.0f + std::exp(-values[i]));
+            }
+            break;
+    }
+}
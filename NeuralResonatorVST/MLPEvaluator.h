@@ -0,0 +1,123 @@
+#pragma once
+
+#include <torch/script.h>
+#include <memory>
+#include <vector>
+
+/**
+ * @brief  Allocation-free evaluator for small fully connected networks
+ * @note   The linear layers and activations are extracted from a
+ * TorchScript module at load time (see fromModule) and evaluated with a
+ * hand-vectorized GEMV kernel (SSE on x86, NEON on arm), bypassing the
+ * IValue boxing and dispatcher of libtorch. The weights are immutable
+ * after construction, so one evaluator can be shared between threads as
+ * long as each thread uses its own Workspace.
+ */
+class MLPEvaluator
+{
+public:
+    enum class Activation
+    {
+        None,
+        ReLU,
+        LeakyReLU,
+        Tanh,
+        Sigmoid
+    };
+
+    struct Layer
+    {
+        int numInputs = 0;
+        int numOutputs = 0;
+        // row major, numOutputs x numInputs
+        std::vector<float> weights;
+        std::vector<float> bias;
+        Activation activation = Activation::None;
+        float negativeSlope = 0.0f;
+    };
+
+    /**
+     * @brief  Scratch memory of one caller, sized by createWorkspace
+     */
+    struct Workspace
+    {
+        std::vector<float> ping;
+        std::vector<float> pong;
+    };
+
+    explicit MLPEvaluator(std::vector<Layer> layers);
+
+    /**
+     * @brief  Extract the layers of a TorchScript module
+     * @note   The module is frozen and its forward graph has to be a chain
+     * of linear layers and supported activations (relu, leaky_relu, tanh,
+     * sigmoid), optionally with dropout and reshapes. Anything else is
+     * reported and nullptr is returned, so the caller can fall back to
+     * libtorch.
+     * @param  module: module in eval mode
+     * @retval the evaluator, or nullptr if the graph is not supported
+     */
+    static std::unique_ptr<MLPEvaluator> fromModule(
+        const torch::jit::Module& module
+    );
+
+    int getNumInputs() const;
+    int getNumOutputs() const;
+
+    /**
+     * @brief  Number of outputs of the first layer, the size of the prefix
+     * used by computePrefix and forwardWithPrefix
+     */
+    int getPrefixSize() const;
+
+    Workspace createWorkspace() const;
+
+    /**
+     * @brief  Evaluate the network
+     * @param  input: getNumInputs() floats
+     * @param  output: getNumOutputs() floats
+     * @param  workspace: scratch memory created by createWorkspace
+     */
+    void forward(const float* input, float* output, Workspace& workspace)
+        const;
+
+    /**
+     * @brief  Compute the part of the first layer that depends on the
+     * leading numCached inputs, including its bias
+     * @param  cachedInputs: numCached floats
+     * @param  numCached: number of leading inputs
+     * @param  prefix: getPrefixSize() floats
+     */
+    void computePrefix(const float* cachedInputs, int numCached, float* prefix)
+        const;
+
+    /**
+     * @brief  Evaluate the network from a prefix computed by computePrefix
+     * @param  prefix: getPrefixSize() floats
+     * @param  trailingInputs: getNumInputs() - numCached floats
+     * @param  numCached: number of leading inputs folded into the prefix
+     * @param  output: getNumOutputs() floats
+     * @param  workspace: scratch memory created by createWorkspace
+     */
+    void forwardWithPrefix(
+        const float* prefix,
+        const float* trailingInputs,
+        int numCached,
+        float* output,
+        Workspace& workspace
+    ) const;
+
+private:
+    void forwardLayers(
+        size_t firstLayer,
+        const float* input,
+        float* output,
+        Workspace& workspace
+    ) const;
+
+    static void applyActivation(const Layer& layer, float* values);
+
+private:
+    std::vector<Layer> mLayers;
+    int mMaxWidth = 0;
+};
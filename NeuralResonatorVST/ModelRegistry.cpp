@@ -0,0 +1,64 @@
+#include "ModelRegistry.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+
+void ModelRegistry::registerTier(const Tier &tier)
+{
+    {
+        const juce::ScopedLock lock(mLock);
+        auto it = std::find_if(
+            mTiers.begin(),
+            mTiers.end(),
+            [&tier](const Tier &other) { return other.name == tier.name; }
+        );
+        if (it != mTiers.end()) { *it = tier; }
+        else { mTiers.push_back(tier); }
+
+        std::stable_sort(
+            mTiers.begin(),
+            mTiers.end(),
+            [](const Tier &a, const Tier &b) { return a.quality < b.quality; }
+        );
+    }
+    JLOG("Model tier registered: " + tier.name);
+    sendChangeMessage();
+}
+
+void ModelRegistry::unregisterTier(const juce::String &name)
+{
+    {
+        const juce::ScopedLock lock(mLock);
+        mTiers.erase(
+            std::remove_if(
+                mTiers.begin(),
+                mTiers.end(),
+                [&name](const Tier &tier) { return tier.name == name; }
+            ),
+            mTiers.end()
+        );
+    }
+    sendChangeMessage();
+}
+
+std::vector<ModelRegistry::Tier> ModelRegistry::getTiers() const
+{
+    const juce::ScopedLock lock(mLock);
+    return mTiers;
+}
+
+void ModelRegistry::setGlobalTier(const juce::String &name)
+{
+    {
+        const juce::ScopedLock lock(mLock);
+        if (mGlobalTier == name) { return; }
+        mGlobalTier = name;
+    }
+    JLOG("Global model tier: " + (name.isEmpty() ? "none" : name));
+    sendChangeMessage();
+}
+
+juce::String ModelRegistry::getGlobalTier() const
+{
+    const juce::ScopedLock lock(mLock);
+    return mGlobalTier;
+}
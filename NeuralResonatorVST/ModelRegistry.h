@@ -0,0 +1,51 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <juce_events/juce_events.h>
+#include <vector>
+
+/**
+ * @brief  Process wide list of the model pairs an instance can run
+ * @note   A tier pairs an encoder with an fc network for the same task, a
+ * small fast fc head next to the full model for example. Tiers are ordered
+ * by quality, from the fastest to the most accurate, and identified by
+ * name, so a selection stored in a session survives re-registration. All
+ * instances share one registry through juce::SharedResourcePointer, and
+ * every change is broadcast to them on the message thread.
+ */
+class ModelRegistry : public juce::ChangeBroadcaster
+{
+public:
+    struct Tier
+    {
+        juce::String name;
+        juce::File encoder;
+        juce::File fc;
+        // higher is more accurate and usually slower
+        int quality = 0;
+    };
+
+    /**
+     * @brief  Add a tier, or replace the tier with the same name
+     */
+    void registerTier(const Tier& tier);
+    void unregisterTier(const juce::String& name);
+
+    /**
+     * @brief  The tiers, from the lowest to the highest quality
+     */
+    std::vector<Tier> getTiers() const;
+
+    /**
+     * @brief  Tier of the instances that follow the global selection
+     * @param  name: a registered tier, empty leaves the models of every
+     * instance as they are
+     */
+    void setGlobalTier(const juce::String& name);
+    juce::String getGlobalTier() const;
+
+private:
+    juce::CriticalSection mLock;
+    std::vector<Tier> mTiers;
+    juce::String mGlobalTier;
+};
@@ -0,0 +1,232 @@
+#include "ModelTierGovernor.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+
+ModelTierGovernor::ModelTierGovernor(
+    juce::AudioProcessorValueTreeState &vts,
+    InferenceTelemetry &telemetry
+)
+    : mVts(vts)
+    , mTelemetry(telemetry)
+{
+    mRegistry->addChangeListener(this);
+    mVts.state.addListener(this);
+    startTimer(kPollIntervalMs);
+}
+
+ModelTierGovernor::~ModelTierGovernor()
+{
+    stopTimer();
+    mVts.state.removeListener(this);
+    mRegistry->removeChangeListener(this);
+}
+
+void ModelTierGovernor::setLatencyBudget(double milliseconds)
+{
+    mLatencyBudgetMs = milliseconds;
+}
+
+void ModelTierGovernor::setMaxPendingJobs(int maxPendingJobs)
+{
+    mMaxPendingJobs = maxPendingJobs;
+}
+
+juce::String ModelTierGovernor::getActiveTier() const
+{
+    return mActiveTier;
+}
+
+void ModelTierGovernor::removeAppliedTier(juce::ValueTree &state) const
+{
+    auto modelTree = state.getChildWithName("model");
+    const juce::ScopedLock lock(mAppliedTierLock);
+    if (!modelTree.isValid() || mAppliedTier.isEmpty()) { return; }
+
+    // a model chosen by path since then is kept
+    for (auto name : {"encoder", "fc"})
+    {
+        if (modelTree.getProperty(name).toString() == mAppliedTier)
+        {
+            modelTree.removeProperty(name, nullptr);
+        }
+    }
+}
+
+void ModelTierGovernor::timerCallback()
+{
+    using Lane = InferenceTelemetry::Lane;
+
+    // measured every poll, so the first governed poll sees a fresh window
+    auto latency = measureLatency();
+
+    auto modelTree = mVts.state.getChildWithName("model");
+    if (!bool(modelTree.getProperty("governor", false))) { return; }
+
+    auto tiers = mRegistry->getTiers();
+    int ceiling = getSelectedTier(tiers);
+    if (ceiling < 0) { ceiling = int(tiers.size()) - 1; }
+    if (ceiling < 1) { return; }
+    int current = mGovernedTier >= 0 ? std::min(mGovernedTier, ceiling)
+                                     : ceiling;
+
+    auto pending = mTelemetry.getLaneSummary(Lane::Encoder).queueDepth +
+                   mTelemetry.getLaneSummary(Lane::FC).queueDepth;
+    if (latency > 0.0)
+    {
+        mTierLatencies[tiers[size_t(current)].name] = latency;
+    }
+
+    if (latency > mLatencyBudgetMs || pending > mMaxPendingJobs)
+    {
+        mQuietPolls = 0;
+        if (current > 0)
+        {
+            mGovernedTier = current - 1;
+            JLOG(
+                "Model tier governor: " + juce::String(latency, 1) +
+                " ms, " + juce::String(pending) + " pending, stepping down"
+            );
+            update();
+        }
+        return;
+    }
+
+    bool quiet = latency < kQuietFraction * mLatencyBudgetMs && pending == 0;
+    if (!quiet)
+    {
+        mQuietPolls = 0;
+        return;
+    }
+    for (auto &tierLatency : mTierLatencies)
+    {
+        tierLatency.second *= kLatencyDecay;
+    }
+    if (current == ceiling || ++mQuietPolls < kQuietPollsToStepUp) { return; }
+
+    // the tier above is retried once its last measurement fits the budget
+    auto above = mTierLatencies.find(tiers[size_t(current + 1)].name);
+    if (above != mTierLatencies.end() && above->second > mLatencyBudgetMs)
+    {
+        return;
+    }
+
+    mQuietPolls = 0;
+    mGovernedTier = current + 1 == ceiling ? -1 : current + 1;
+    JLOG("Model tier governor: quiet, stepping up");
+    update();
+}
+
+void ModelTierGovernor::changeListenerCallback(juce::ChangeBroadcaster *)
+{
+    update();
+}
+
+void ModelTierGovernor::valueTreePropertyChanged(
+    juce::ValueTree &changedTree,
+    const juce::Identifier &changedProperty
+)
+{
+    if (!changedTree.hasType("model")) { return; }
+
+    // the models are written by update itself
+    if (changedProperty == juce::Identifier("governor"))
+    {
+        mGovernedTier = -1;
+        mQuietPolls = 0;
+        update();
+    }
+    else if (changedProperty == juce::Identifier("tier")) { update(); }
+}
+
+void ModelTierGovernor::valueTreeRedirected(juce::ValueTree &)
+{
+    mGovernedTier = -1;
+    mQuietPolls = 0;
+    update();
+}
+
+int ModelTierGovernor::getSelectedTier(
+    const std::vector<ModelRegistry::Tier> &tiers
+) const
+{
+    // the tier of the instance, or the global one
+    auto modelTree = mVts.state.getChildWithName("model");
+    auto name = modelTree.getProperty("tier").toString();
+    if (name.isEmpty()) { name = mRegistry->getGlobalTier(); }
+
+    for (size_t i = 0; i < tiers.size(); i++)
+    {
+        if (tiers[i].name == name) { return int(i); }
+    }
+    return -1;
+}
+
+void ModelTierGovernor::update()
+{
+    auto tiers = mRegistry->getTiers();
+    int tier = getSelectedTier(tiers);
+
+    auto modelTree = mVts.state.getChildWithName("model");
+    if (bool(modelTree.getProperty("governor", false)))
+    {
+        int ceiling = tier >= 0 ? tier : int(tiers.size()) - 1;
+        tier = mGovernedTier >= 0 ? std::min(mGovernedTier, ceiling)
+                                  : ceiling;
+    }
+
+    // without a tier the models stay as they are
+    if (tier < 0)
+    {
+        mActiveTier = {};
+        const juce::ScopedLock lock(mAppliedTierLock);
+        mAppliedTier = {};
+        return;
+    }
+
+    const auto &selected = tiers[size_t(tier)];
+    if (selected.name != mActiveTier)
+    {
+        JLOG("Model tier: " + selected.name);
+        mActiveTier = selected.name;
+    }
+
+    // the name resolves to the paths of the tier when it is loaded, so no
+    // path of this machine ends up in a session. Unchanged names do not
+    // notify, so this only swaps on a change
+    {
+        const juce::ScopedLock lock(mAppliedTierLock);
+        mAppliedTier = selected.name;
+    }
+    modelTree = mVts.state.getOrCreateChildWithName("model", nullptr);
+    modelTree.setProperty("encoder", selected.name, nullptr);
+    modelTree.setProperty("fc", selected.name, nullptr);
+}
+
+double ModelTierGovernor::measureLatency()
+{
+    using Stage = InferenceTelemetry::Stage;
+
+    // a shape change runs both networks, a parameter change only the fc
+    // network, the sum of the means covers the slower of the two
+    double latency = 0.0;
+    const Stage stages[] = {Stage::EncoderForward, Stage::FCForward};
+    for (size_t i = 0; i < mLastCounts.size(); i++)
+    {
+        auto summary = mTelemetry.getSummary(stages[i]);
+
+        // a reset of the telemetry starts a new window
+        if (summary.count < mLastCounts[i])
+        {
+            mLastCounts[i] = 0;
+            mLastTotals[i] = 0.0;
+        }
+        auto count = summary.count - mLastCounts[i];
+        if (count > 0)
+        {
+            latency += (summary.total - mLastTotals[i]) / double(count);
+        }
+        mLastCounts[i] = summary.count;
+        mLastTotals[i] = summary.total;
+    }
+    return latency * 1e-3;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "InferenceTelemetry.h"
+#include "ModelRegistry.h"
+
+#include <juce_audio_processors/juce_audio_processors.h>
+#include <juce_events/juce_events.h>
+#include <array>
+#include <map>
+#include <vector>
+
+/**
+ * @brief  Selects the model tier of one instance
+ * @note   An instance uses the tier named by the "tier" property of its
+ * model tree, or the global tier of the ModelRegistry when that is empty.
+ * With the governor enabled (the "governor" property), that tier is the
+ * ceiling: the governor steps down one tier when the mean encoder plus fc
+ * latency of the last poll exceeds the budget or too many jobs are
+ * pending, and steps back up after a few quiet polls, unless the tier
+ * above was already measured over budget. Those measurements decay while
+ * the instance is quiet, so a tier is retried once the load has gone.
+ * A tier is applied by writing its name into the model tree, which swaps
+ * the models in the background (see TorchWrapper::loadModels). Sessions
+ * only keep the "tier" and "governor" properties, the applied tier is
+ * left out of them (see removeAppliedTier) and chosen again on restore.
+ * Runs on the message thread.
+ */
+class ModelTierGovernor : private juce::Timer,
+                          private juce::ChangeListener,
+                          private juce::ValueTree::Listener
+{
+public:
+    ModelTierGovernor(
+        juce::AudioProcessorValueTreeState& vts,
+        InferenceTelemetry& telemetry
+    );
+    ~ModelTierGovernor() override;
+
+    /**
+     * @brief  Latency per request above which the governor steps down
+     */
+    void setLatencyBudget(double milliseconds);
+
+    /**
+     * @brief  Queued encoder and fc jobs above which the governor steps
+     * down
+     */
+    void setMaxPendingJobs(int maxPendingJobs);
+
+    /**
+     * @brief  Name of the tier in use, empty if the models were not chosen
+     * by tier
+     */
+    juce::String getActiveTier() const;
+
+    /**
+     * @brief  Remove the models written by the governor from a copy of
+     * the state that is about to be saved
+     * @note   Safe to call from any thread
+     */
+    void removeAppliedTier(juce::ValueTree& state) const;
+
+private:
+    void timerCallback() override;
+    void changeListenerCallback(juce::ChangeBroadcaster* source) override;
+    void valueTreePropertyChanged(
+        juce::ValueTree& changedTree,
+        const juce::Identifier& changedProperty
+    ) override;
+    void valueTreeRedirected(juce::ValueTree& redirectedTree) override;
+
+    /**
+     * @brief  Index of the selected tier, the ceiling of the governor
+     * @retval -1 if no tier is selected
+     */
+    int getSelectedTier(const std::vector<ModelRegistry::Tier>& tiers) const;
+
+    /**
+     * @brief  Apply the selected or governed tier if it changed
+     */
+    void update();
+
+    /**
+     * @brief  Mean latency per request since the last poll, in ms
+     */
+    double measureLatency();
+
+private:
+    static constexpr int kPollIntervalMs = 500;
+    // quiet polls before stepping up, and the share of the budget below
+    // which a poll counts as quiet
+    static constexpr int kQuietPollsToStepUp = 6;
+    static constexpr double kQuietFraction = 0.5;
+    // decay of the latencies measured at the tiers, per quiet poll
+    static constexpr double kLatencyDecay = 0.9;
+
+    juce::AudioProcessorValueTreeState& mVts;
+    InferenceTelemetry& mTelemetry;
+    juce::SharedResourcePointer<ModelRegistry> mRegistry;
+
+    double mLatencyBudgetMs = 50.0;
+    int mMaxPendingJobs = 4;
+
+    // tier below the ceiling while governed, -1 when at the ceiling
+    int mGovernedTier = -1;
+    int mQuietPolls = 0;
+    std::map<juce::String, double> mTierLatencies;
+    juce::String mActiveTier;
+    // the name written into the model tree, read when a session is saved
+    juce::CriticalSection mAppliedTierLock;
+    juce::String mAppliedTier;
+
+    // telemetry totals at the previous poll
+    std::array<uint64_t, 2> mLastCounts{};
+    std::array<double, 2> mLastTotals{};
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ModelTierGovernor)
+};
@@ -0,0 +1,119 @@
+#include "ModelTransforms.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <limits>
+
+bool ModelTransforms::foldRepeatedInputChannels(
+    torch::jit::Module &module,
+    int64_t numChannels
+)
+{
+    torch::NoGradGuard noGrad;
+
+    for (const auto &parameter : module.named_parameters(/*recurse=*/true))
+    {
+        auto weight = parameter.value;
+        if (weight.dim() != 4) { continue; }
+
+        // only the first convolution sees the input
+        if (weight.size(1) != numChannels)
+        {
+            JLOG(
+                "First convolution " + parameter.name + " has " +
+                std::to_string(weight.size(1)) + " input channels, not " +
+                std::to_string(numChannels)
+            );
+            return false;
+        }
+
+        weight.set_data(weight.sum(1, /*keepdim=*/true));
+        JLOG("Folded input channels into " + parameter.name);
+        return true;
+    }
+
+    JLOG("No convolution found to fold the input channels into");
+    return false;
+}
+
+bool ModelTransforms::splitFirstLinear(
+    torch::jit::Module &module,
+    int64_t numInputs,
+    int64_t numCached,
+    SplitLinear &split
+)
+{
+    torch::NoGradGuard noGrad;
+
+    const std::string weightSuffix = "weight";
+    for (const auto &parameter : module.named_parameters(/*recurse=*/true))
+    {
+        auto weight = parameter.value;
+        if (weight.dim() != 2) { continue; }
+
+        // only the first linear layer sees the input
+        const auto &name = parameter.name;
+        bool isWeight = name.size() >= weightSuffix.size() &&
+                        name.compare(
+                            name.size() - weightSuffix.size(),
+                            weightSuffix.size(),
+                            weightSuffix
+                        ) == 0;
+        if (!isWeight || weight.size(1) != numInputs)
+        {
+            JLOG("First linear layer " + name + " does not match the input");
+            return false;
+        }
+
+        // find the bias of the same layer
+        auto biasName =
+            name.substr(0, name.size() - weightSuffix.size()) + "bias";
+        torch::Tensor bias;
+        for (const auto &candidate : module.named_parameters(true))
+        {
+            if (candidate.name == biasName) { bias = candidate.value; }
+        }
+        if (!bias.defined() || bias.dim() != 1 ||
+            bias.size(0) != weight.size(0))
+        {
+            JLOG("First linear layer " + name + " has no bias");
+            return false;
+        }
+
+        split.cachedWeight = weight.narrow(1, 0, numCached).contiguous();
+        split.bias = bias.clone();
+        split.moduleBias = bias;
+        split.moduleBias.requires_grad_(false);
+
+        weight.set_data(
+            weight.narrow(1, numCached, numInputs - numCached).contiguous()
+        );
+        JLOG("Split the first linear layer " + name);
+        return true;
+    }
+
+    JLOG("No linear layer found to split");
+    return false;
+}
+
+void ModelTransforms::updateSplitBias(
+    SplitLinear &split,
+    const torch::Tensor &cached
+)
+{
+    torch::NoGradGuard noGrad;
+    at::addmv_out(split.moduleBias, split.bias, split.cachedWeight, cached);
+}
+
+float ModelTransforms::relativeMaxDifference(
+    const torch::Tensor &reference,
+    const torch::Tensor &other
+)
+{
+    if (reference.sizes() != other.sizes())
+    {
+        return std::numeric_limits<float>::infinity();
+    }
+
+    auto scale = std::max(reference.abs().max().item<float>(), 1e-6f);
+    return (reference - other).abs().max().item<float>() / scale;
+}
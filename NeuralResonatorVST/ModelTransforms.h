@@ -0,0 +1,81 @@
+#pragma once
+
+#include <torch/script.h>
+#include <torch/torch.h>
+
+/**
+ * @brief  Load-time transformations of the TorchScript models
+ * @note   The transformations modify the parameters of a module in place,
+ * callers are expected to work on a copy (Module::deepcopy) and to verify
+ * the result before using it.
+ */
+class ModelTransforms
+{
+public:
+    /**
+     * @brief  The first linear layer of a module, split in two column blocks
+     */
+    struct SplitLinear
+    {
+        // leading numCached columns of the original weight
+        torch::Tensor cachedWeight;
+        // copy of the original bias
+        torch::Tensor bias;
+        // the bias parameter of the transformed module, written in place
+        torch::Tensor moduleBias;
+    };
+
+    /**
+     * @brief  Fold a channel-repeated input into the first convolution
+     * @note   When the input is a single channel repeated numChannels times,
+     * conv(repeat(x), W) == conv(x, sum(W, 1)). The first 4d weight with
+     * numChannels input channels is replaced by its sum over the input
+     * channel axis, so the module can be fed the single channel directly.
+     * @param  module: module to transform in place
+     * @param  numChannels: number of repeated input channels
+     * @retval true if a matching convolution was found and folded
+     */
+    static bool foldRepeatedInputChannels(
+        torch::jit::Module& module,
+        int64_t numChannels
+    );
+
+    /**
+     * @brief  Split the first linear layer so its leading inputs can be
+     * cached
+     * @note   y = W_c * c + W_p * p + b. The first 2d weight with numInputs
+     * columns is replaced by W_p, so the module takes only the trailing
+     * numInputs - numCached inputs. W_c * c + b must then be written into
+     * split.moduleBias every time c changes (see updateSplitBias).
+     * @param  module: module to transform in place
+     * @param  numInputs: number of inputs of the original module
+     * @param  numCached: number of leading inputs to cache
+     * @param  split: the cached weight and the bias handles
+     * @retval true if a linear layer with a bias was found and split
+     */
+    static bool splitFirstLinear(
+        torch::jit::Module& module,
+        int64_t numInputs,
+        int64_t numCached,
+        SplitLinear& split
+    );
+
+    /**
+     * @brief  Write W_c * cached + b into the bias of a split module
+     * @param  split: the split returned by splitFirstLinear
+     * @param  cached: 1d tensor with the cached inputs
+     */
+    static void updateSplitBias(
+        SplitLinear& split,
+        const torch::Tensor& cached
+    );
+
+    /**
+     * @brief  Largest absolute difference between two tensors, relative to
+     * the largest absolute value of the reference
+     */
+    static float relativeMaxDifference(
+        const torch::Tensor& reference,
+        const torch::Tensor& other
+    );
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief  Fixed capacity single producer, single consumer queue of
+ * parameter changes
+ * @note   Every change is an (index, value) event in a juce::AbstractFifo,
+ * stamped with the sample position it was seen at, so pushing never
+ * allocates, locks or waits, and the consumer never sees a value that is
+ * still being written. It is safe to push from the audio thread. When the
+ * fifo is full the latest value of the index is kept in a per index
+ * overflow slot instead and applied after the queued events, so the last
+ * value always arrives. The overflowed values come in stamp order.
+ */
+class ParameterEventQueue
+{
+public:
+    struct Event
+    {
+        int index;
+        float value;
+        int64_t samplePosition;
+    };
+
+    static constexpr int kMaxIndices = 32;
+
+    /**
+     * @param  capacity: number of events the fifo holds
+     * @param  numIndices: parameter indices are in [0, numIndices)
+     */
+    ParameterEventQueue(int capacity, int numIndices)
+        // an AbstractFifo holds one item less than its size
+        : mFifo(capacity + 1),
+          mEvents(size_t(capacity + 1)),
+          mNumIndices(numIndices)
+    {
+        jassert(numIndices <= kMaxIndices);
+        for (auto& value : mOverflowValues) { value = 0.0f; }
+        for (auto& stamp : mOverflowStamps) { stamp = 0; }
+    }
+
+    /**
+     * @brief  Queue a change, producer only
+     * @param  samplePosition: where the change was seen, never decreasing
+     */
+    void push(int index, float value, int64_t samplePosition)
+    {
+        jassert(index >= 0 && index < mNumIndices);
+        const uint32_t bit = 1u << uint32_t(index);
+
+        // once an index overflowed, its changes stay in the overflow slot
+        // until the consumer took it, so they are never applied out of order
+        if ((mOverflowMask.load() & bit) == 0)
+        {
+            const auto scope = mFifo.write(1);
+            if (scope.blockSize1 + scope.blockSize2 == 1)
+            {
+                auto start = scope.blockSize1 == 1 ? scope.startIndex1
+                                                   : scope.startIndex2;
+                mEvents[size_t(start)] = {index, value, samplePosition};
+                return;
+            }
+        }
+        mOverflowStamps[size_t(index)] = samplePosition;
+        mOverflowValues[size_t(index)] = value;
+        mOverflowMask.fetch_or(bit);
+    }
+
+    /**
+     * @brief  Hand every queued change to fn(index, value, samplePosition)
+     * in order, consumer only
+     * @retval the number of changes
+     */
+    template <typename Fn>
+    int drain(Fn&& fn)
+    {
+        int numChanges = 0;
+        const auto scope = mFifo.read(mFifo.getNumReady());
+        for (int i = 0; i < scope.blockSize1; i++)
+        {
+            const auto& event = mEvents[size_t(scope.startIndex1 + i)];
+            fn(event.index, event.value, event.samplePosition);
+        }
+        for (int i = 0; i < scope.blockSize2; i++)
+        {
+            const auto& event = mEvents[size_t(scope.startIndex2 + i)];
+            fn(event.index, event.value, event.samplePosition);
+        }
+        numChanges += scope.blockSize1 + scope.blockSize2;
+
+        // a push racing with this may pair a newer value with an older
+        // stamp, it is then handed over again by the next drain
+        std::array<Event, kMaxIndices> overflowed;
+        int numOverflowed = 0;
+        auto mask = mOverflowMask.exchange(0);
+        for (int index = 0; mask != 0; index++, mask >>= 1)
+        {
+            if ((mask & 1u) == 0) { continue; }
+            Event event{
+                index,
+                mOverflowValues[size_t(index)].load(),
+                mOverflowStamps[size_t(index)].load()};
+
+            // insertion sort by stamp, there are only a few
+            int i = numOverflowed++;
+            while (i > 0 &&
+                   overflowed[size_t(i - 1)].samplePosition >
+                       event.samplePosition)
+            {
+                overflowed[size_t(i)] = overflowed[size_t(i - 1)];
+                i--;
+            }
+            overflowed[size_t(i)] = event;
+        }
+        for (int i = 0; i < numOverflowed; i++)
+        {
+            const auto& event = overflowed[size_t(i)];
+            fn(event.index, event.value, event.samplePosition);
+        }
+        return numChanges + numOverflowed;
+    }
+
+private:
+    juce::AbstractFifo mFifo;
+    std::vector<Event> mEvents;
+    int mNumIndices;
+
+    std::array<std::atomic<float>, kMaxIndices> mOverflowValues;
+    std::array<std::atomic<int64_t>, kMaxIndices> mOverflowStamps;
+    std::atomic<uint32_t> mOverflowMask{0};
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ParameterEventQueue)
+};
@@ -185,6 +185,24 @@ void ParameterSyncer::receivedShapeUpdate(const juce::var& shape)
     );
 }
 
+void ParameterSyncer::receivedLoadModel(const juce::var& model)
+{
+    juce::MessageManager::callAsync(
+        [this, model]()
+        {
+            auto modelTree =
+                mVTSRef.state.getOrCreateChildWithName("model", nullptr);
+            for (auto name : {"encoder", "fc"})
+            {
+                if (model.hasProperty(name))
+                {
+                    modelTree.setProperty(name, model[name], nullptr);
+                }
+            }
+        }
+    );
+}
+
 void ParameterSyncer::onOpen()
 {
     // send the full state tree to the server
@@ -25,6 +25,13 @@ protected:
     void receivedParameterChange(const juce::var& parameter) override;
     void receivedNewShape(const juce::var& shape) override;
     void receivedShapeUpdate(const juce::var& shape) override;
+    /**
+     * @brief  receivedLoadModel
+     * @note   writes the "encoder" and "fc" model paths into the model
+     * tree, a missing path keeps the current model
+     * @retval None
+     */
+    void receivedLoadModel(const juce::var& model) override;
 
     void onOpen() override;
     void onClose() override;
@@ -9,6 +9,7 @@ public:
     virtual void receivedParameterChange(const juce::var& parameter) = 0;
     virtual void receivedNewShape(const juce::var& shape) = 0;
     virtual void receivedShapeUpdate(const juce::var& shape) = 0;
+    virtual void receivedLoadModel(const juce::var& model) = 0;
     virtual void onOpen() = 0;
     virtual void onClose() = 0;
 };
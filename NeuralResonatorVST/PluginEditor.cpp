@@ -31,7 +31,6 @@ AudioPluginAudioProcessorEditor::AudioPluginAudioProcessorEditor(
     mServerThreadPtr.reset(
         new ServerThread(mParameterSyncerPtr->getParameterSyncerIfPtr())
     );
-    mServerThreadPtr->startThread();
 
     // Pass the server thread to the parameter syncer
     mParameterSyncerPtr->setServerThreadIf(
@@ -63,6 +62,7 @@ AudioPluginAudioProcessorEditor::AudioPluginAudioProcessorEditor(
             );
         }
     );
+    mServerThreadPtr->start();
 
     setOpaque(true);
     mBrowserPtr.reset(new BrowserComponent());
@@ -112,4 +112,4 @@ void AudioPluginAudioProcessorEditor::resized()
 #else
     if (mBrowserPtr) { mBrowserPtr->setBounds(getBounds()); }
 #endif
-}
\ No newline at end of file
+}
\ No newline at end of file
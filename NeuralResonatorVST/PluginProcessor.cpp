@@ -3,6 +3,8 @@
 #include "HelperFunctions.h"
 #include <geometry/generate_polygon.hpp>
 #include <geometry/morphisms.hpp>
+#include <algorithm>
+#include <cstring>
 //==============================================================================
 AudioPluginAudioProcessor::AudioPluginAudioProcessor()
     : AudioProcessor(
@@ -21,6 +23,8 @@ AudioPluginAudioProcessor::AudioPluginAudioProcessor()
           createParameterLayout()                        // parameter layout
       )
     , mFilterbank(32, 2)
+    , mControlRateInference(mParameters, mTelemetry)
+    , mTierGovernor(mParameters, mTelemetry)
 {
     // Set up the logger
     mFileLoggerPtr.reset(juce::FileLogger::createDefaultAppLogger(
@@ -47,9 +51,21 @@ AudioPluginAudioProcessor::AudioPluginAudioProcessor()
         new TorchWrapper(this, mParameters, fcPath, encoderPath)
     );
 
-    // Start the threads in order (from the bottom up)
-    mQueueThread.startThread();
-    mTorchWrapperPtr->startThread();
+    // the bundled models are the most accurate tier, smaller ones can be
+    // registered next to them by the host application
+    juce::SharedResourcePointer<ModelRegistry> modelRegistry;
+    auto tiers = modelRegistry->getTiers();
+    if (std::none_of(
+            tiers.begin(),
+            tiers.end(),
+            [](const ModelRegistry::Tier& tier)
+            { return tier.name == "full"; }
+        ))
+    {
+        modelRegistry->registerTier(
+            {"full", juce::File(encoderPath), juce::File(fcPath), 100}
+        );
+    }
 }
 
 AudioPluginAudioProcessor::~AudioPluginAudioProcessor()
@@ -59,7 +75,7 @@ AudioPluginAudioProcessor::~AudioPluginAudioProcessor()
     mTorchWrapperPtr.reset();
     mTorchWrapperPtr = nullptr;
 
-    mQueueThread.stopThread(100);
+    mStrand.stop();
 
     juce::Logger::setCurrentLogger(nullptr);
 }
@@ -148,6 +164,42 @@ void AudioPluginAudioProcessor::prepareToPlay(
     unsigned int interpolationDelta =
         (unsigned int)(interpolationDeltaSeconds * sampleRate);
     mFilterbank.setInterpolationDelta(interpolationDelta);
+
+    // allocated here so the audio thread inference never allocates
+    mControlRateCoefficients.resize(TorchWrapper::kNumCoefficients);
+    mSamplesUntilInference = 0;
+    mSamplePosition = 0;
+    mSynchronousCoefficients.resize(TorchWrapper::kNumCoefficients);
+    mHasSynchronousState = false;
+    mSynchronousFailed = false;
+
+    // the lookahead is reported as latency, so the host keeps the delayed
+    // audio aligned with the rest of the project. Only offline renders
+    // predict ahead, in real time the coefficients would be heard early.
+    mLookaheadBatchSize = isNonRealtime() ? mLookaheadBlocks.load() : 0;
+    mLookaheadSamples = mLookaheadBatchSize * samplesPerBlock;
+    mLookaheadBuffer.setSize(
+        getTotalNumOutputChannels(),
+        std::max(mLookaheadSamples, 1)
+    );
+    mLookaheadBuffer.clear();
+    mLookaheadWritePosition = 0;
+    mLookaheadPositions.clear();
+    mLookaheadStates.clear();
+    mLookaheadStates.reserve(size_t(mLookaheadBatchSize));
+    mLookaheadCoefficients.resize(
+        size_t(mLookaheadBatchSize) * TorchWrapper::kNumCoefficients
+    );
+    // every change of the delayed blocks and the current one can be
+    // waiting for its sample, the frames are reused from here on
+    mLookaheadFrames.resize(size_t(2 * mLookaheadBatchSize + 2));
+    for (auto& frame : mLookaheadFrames)
+    {
+        frame.coefficients.resize(TorchWrapper::kNumCoefficients);
+    }
+    mLookaheadFrameRead = 0;
+    mLookaheadFrameCount = 0;
+    setLatencySamples(mLookaheadSamples);
 }
 
 void AudioPluginAudioProcessor::releaseResources()
@@ -211,6 +263,47 @@ void AudioPluginAudioProcessor::processBlock(
     // interleaved by keeping the same state.
     // https://forum.juce.com/t/1-most-common-programming-mistake-that-we-see-on-the-forum/26013
 
+    // measure how long the last coefficients took to reach this thread
+    auto appliedTicks = mCoefficientsAppliedTicks.exchange(0);
+    if (appliedTicks != 0)
+    {
+        mTelemetry.record(
+            InferenceTelemetry::Stage::AudioPickup,
+            appliedTicks
+        );
+    }
+
+    // parameter changes reach inference from the audio thread, even when
+    // the message thread is blocked
+    auto blockPosition = mSamplePosition;
+    mTorchWrapperPtr->pollParameters(blockPosition);
+    mSamplePosition += buffer.getNumSamples();
+
+    // offline renders predict inline and apply the result at the first
+    // sample of the block, so they do not depend on thread scheduling.
+    // They never extrapolate, only the native evaluator on the audio
+    // thread takes the place of the synchronous prediction.
+    bool offline = isNonRealtime();
+    bool controlRate = mControlRateInference.isActive(!offline);
+    bool synchronous = mOfflineSynchronous && offline && !controlRate &&
+                       !mSynchronousFailed;
+    bool lookahead = mLookaheadSamples > 0 && offline;
+    mRenderingSynchronously = synchronous;
+    if (synchronous && lookahead)
+    {
+        collectLookaheadState(blockPosition, buffer.getNumSamples());
+    }
+    else if (synchronous) { predictBlockSynchronously(); }
+    else if (mLookaheadFrameCount > 0 || !mLookaheadStates.empty())
+    {
+        // back in real time, the background predictions take over
+        mLookaheadPositions.clear();
+        mLookaheadStates.clear();
+        mLookaheadFrameRead = 0;
+        mLookaheadFrameCount = 0;
+        mHasSynchronousState = false;
+    }
+
     // if we receive any midi message and the
     // buffer is empty, then create a buffer
     // with an impulse
@@ -231,8 +324,49 @@ void AudioPluginAudioProcessor::processBlock(
         }
     }
 
+    // the audio is processed mLookaheadSamples late, offline it follows
+    // the frames predicted ahead of it
+    if (lookahead)
+    {
+        delayForLookahead(buffer);
+        if (synchronous)
+        {
+            processLookaheadFrames(buffer, blockPosition);
+            return;
+        }
+    }
+
     // Process samples
-    mFilterbank.processBuffer(buffer);
+    if (!controlRate || mControlRateCoefficients.empty())
+    {
+        mFilterbank.processBuffer(buffer);
+        return;
+    }
+
+    // Evaluate the fc network every interval samples. The countdown carries
+    // over between blocks, so the evaluation grid does not depend on the
+    // block size of the host.
+    int numSamples = buffer.getNumSamples();
+    int position = 0;
+    while (position < numSamples)
+    {
+        if (mSamplesUntilInference <= 0)
+        {
+            if (mControlRateInference.process(
+                    mControlRateCoefficients,
+                    !offline
+                ))
+            {
+                applyCoefficients(mControlRateCoefficients);
+            }
+            mSamplesUntilInference = mControlRateInference.getInterval();
+        }
+
+        int length = std::min(mSamplesUntilInference, numSamples - position);
+        mFilterbank.processBuffer(buffer, position, length);
+        position += length;
+        mSamplesUntilInference -= length;
+    }
 }
 
 //==============================================================================
@@ -259,9 +393,10 @@ void AudioPluginAudioProcessor::getStateInformation(
     // complex data.
     JLOG("AudioPluginAudioProcessor::getStateInformation");
     juce::MemoryOutputStream stream(destData, false);
-    auto str =
-        juce::JSON::toString(HelperFunctions::convertToVar(mParameters.state)
-        );
+    // the models of a tier are chosen again from its name on restore
+    auto state = mParameters.state.createCopy();
+    mTierGovernor.removeAppliedTier(state);
+    auto str = juce::JSON::toString(HelperFunctions::convertToVar(state));
     // JLOG("AudioPluginAudioProcessor::getStateInformation: " + str);
     stream.writeString(str);
 }
@@ -287,8 +422,23 @@ void AudioPluginAudioProcessor::coefficentsChanged(
     const std::vector<float>& coeffs
 )
 {
-    mQueueThread.getIoService().post(
-        [this, coeffs]() { this->handleCoefficentsChanged(coeffs); }
+    // an offline render applies its own predictions at the exact sample
+    if (mRenderingSynchronously) { return; }
+
+    auto handoffStart = InferenceTelemetry::now();
+    mStrand.post(
+        [this, coeffs, handoffStart]()
+        {
+            // the render may have started while this was queued
+            if (mRenderingSynchronously) { return; }
+            this->handleCoefficentsChanged(coeffs);
+            mTelemetry.record(
+                InferenceTelemetry::Stage::Handoff,
+                handoffStart
+            );
+            mCoefficientsAppliedTicks = InferenceTelemetry::now();
+            mTelemetry.logSummaryIfDue();
+        }
     );
 }
 
@@ -299,14 +449,308 @@ void AudioPluginAudioProcessor::handleCoefficentsChanged(
     JLOG("Coefficents changed");
     // JLOG("Number of coefficients: " +
     //                          std::to_string(coefficients.size()));
-    if (firstCoefficients)
-    { 
+    applyCoefficients(coefficients);
+}
+
+void AudioPluginAudioProcessor::applyCoefficients(
+    const std::vector<float>& coefficients
+)
+{
+    if (firstCoefficients.exchange(false))
+    {
         mFilterbank.setCoefficients(coefficients, false);
-        firstCoefficients = false;
     }
     mFilterbank.setCoefficients(coefficients);
 }
 
+void AudioPluginAudioProcessor::predictBlockSynchronously()
+{
+    ResonatorState state;
+    mTorchWrapperPtr->readParameters(state);
+    if (mHasSynchronousState &&
+        std::memcmp(&state, &mSynchronousState, sizeof(state)) == 0)
+    {
+        return;
+    }
+
+    if (mTorchWrapperPtr->predictSynchronously(
+            state,
+            mSynchronousCoefficients
+        ))
+    {
+        applyCoefficients(mSynchronousCoefficients);
+        mSynchronousState = state;
+        mHasSynchronousState = true;
+    }
+    else { synchronousPredictionFailed(); }
+}
+
+void AudioPluginAudioProcessor::synchronousPredictionFailed()
+{
+    // retrying could block every following block up to the timeout
+    JLOG("Synchronous prediction failed, predicting in the background");
+    mSynchronousFailed = true;
+    mHasSynchronousState = false;
+}
+
+void AudioPluginAudioProcessor::delayForLookahead(
+    juce::AudioBuffer<float>& buffer
+)
+{
+    int numSamples = buffer.getNumSamples();
+    int numChannels =
+        std::min(buffer.getNumChannels(), mLookaheadBuffer.getNumChannels());
+    for (int channel = 0; channel < numChannels; channel++)
+    {
+        auto* samples = buffer.getWritePointer(channel);
+        auto* delayed = mLookaheadBuffer.getWritePointer(channel);
+        int position = mLookaheadWritePosition;
+        for (int i = 0; i < numSamples; i++)
+        {
+            std::swap(samples[i], delayed[position]);
+            if (++position == mLookaheadSamples) { position = 0; }
+        }
+    }
+    mLookaheadWritePosition =
+        int((mLookaheadWritePosition + numSamples) % mLookaheadSamples);
+}
+
+void AudioPluginAudioProcessor::collectLookaheadState(
+    int64_t blockPosition,
+    int numSamples
+)
+{
+    ResonatorState state;
+    mTorchWrapperPtr->readParameters(state);
+    if (!mHasSynchronousState ||
+        std::memcmp(&state, &mSynchronousState, sizeof(state)) != 0)
+    {
+        mLookaheadPositions.push_back(blockPosition);
+        mLookaheadStates.push_back(state);
+        mSynchronousState = state;
+        mHasSynchronousState = true;
+    }
+
+    // predict once the batch is full, or when the audio of the oldest
+    // change is processed in this block
+    auto processedEnd = blockPosition - mLookaheadSamples + numSamples;
+    bool due = !mLookaheadPositions.empty() &&
+               mLookaheadPositions.front() < processedEnd;
+    if (due || int(mLookaheadStates.size()) >= mLookaheadBatchSize)
+    {
+        predictLookaheadStates();
+    }
+}
+
+void AudioPluginAudioProcessor::predictLookaheadStates()
+{
+    if (mLookaheadStates.empty()) { return; }
+
+    // a failed batch is dropped, the background predictions take over
+    if (mTorchWrapperPtr->predictBatchSynchronously(
+            mLookaheadStates,
+            mLookaheadCoefficients
+        ))
+    {
+        for (size_t i = 0; i < mLookaheadStates.size(); i++)
+        {
+            // a full ring applies its oldest frame early rather than
+            // allocating on the audio thread
+            if (mLookaheadFrameCount == mLookaheadFrames.size())
+            {
+                popLookaheadFrame();
+            }
+            auto& frame = mLookaheadFrames
+                [(mLookaheadFrameRead + mLookaheadFrameCount) %
+                 mLookaheadFrames.size()];
+            auto first = mLookaheadCoefficients.begin() +
+                         std::ptrdiff_t(i * TorchWrapper::kNumCoefficients);
+            std::copy(
+                first,
+                first + TorchWrapper::kNumCoefficients,
+                frame.coefficients.begin()
+            );
+            frame.samplePosition = mLookaheadPositions[i];
+            mLookaheadFrameCount++;
+        }
+    }
+    else { synchronousPredictionFailed(); }
+
+    mLookaheadPositions.clear();
+    mLookaheadStates.clear();
+}
+
+void AudioPluginAudioProcessor::processLookaheadFrames(
+    juce::AudioBuffer<float>& buffer,
+    int64_t blockPosition
+)
+{
+    // the delayed audio of this block started mLookaheadSamples earlier
+    auto start = blockPosition - mLookaheadSamples;
+    int numSamples = buffer.getNumSamples();
+    int position = 0;
+    while (position < numSamples)
+    {
+        while (mLookaheadFrameCount > 0 &&
+               mLookaheadFrames[mLookaheadFrameRead].samplePosition <=
+                   start + position)
+        {
+            popLookaheadFrame();
+        }
+
+        int end = numSamples;
+        if (mLookaheadFrameCount > 0)
+        {
+            auto next =
+                mLookaheadFrames[mLookaheadFrameRead].samplePosition - start;
+            end = int(std::min<int64_t>(next, numSamples));
+        }
+        mFilterbank.processBuffer(buffer, position, end - position);
+        position = end;
+    }
+}
+
+void AudioPluginAudioProcessor::popLookaheadFrame()
+{
+    applyCoefficients(mLookaheadFrames[mLookaheadFrameRead].coefficients);
+    mLookaheadFrameRead = (mLookaheadFrameRead + 1) % mLookaheadFrames.size();
+    mLookaheadFrameCount--;
+}
+
+void AudioPluginAudioProcessor::fcPrefixChanged(
+    std::shared_ptr<const MLPEvaluator> evaluator,
+    const std::vector<float>& prefix
+)
+{
+    mControlRateInference.setPrefix(std::move(evaluator), prefix);
+}
+
+void AudioPluginAudioProcessor::setAudioThreadInference(
+    bool enabled,
+    int intervalSamples
+)
+{
+    JLOG(
+        juce::String("Audio thread inference ") +
+        (enabled ? "enabled" : "disabled") + ", interval " +
+        juce::String(intervalSamples)
+    );
+    mControlRateInference.setInterval(intervalSamples);
+    mControlRateInference.setEnabled(enabled);
+    mTorchWrapperPtr->setAudioThreadInferenceEnabled(enabled);
+}
+
+double AudioPluginAudioProcessor::getAudioThreadInferenceWorstCase() const
+{
+    return mControlRateInference.getWorstCaseCostMicroseconds();
+}
+
+void AudioPluginAudioProcessor::linearizationChanged(
+    const CoefficientLinearization& linearization
+)
+{
+    mControlRateInference.setLinearization(linearization);
+}
+
+void AudioPluginAudioProcessor::setCoefficientExtrapolation(
+    bool enabled,
+    float maxDelta,
+    float maxError
+)
+{
+    JLOG(
+        juce::String("Coefficient extrapolation ") +
+        (enabled ? "enabled" : "disabled")
+    );
+    mControlRateInference.setExtrapolationBounds(maxDelta, maxError);
+    mControlRateInference.setExtrapolationEnabled(enabled);
+    mTorchWrapperPtr->setLinearizationEnabled(enabled);
+}
+
+uint64_t AudioPluginAudioProcessor::getNumRejectedExtrapolations() const
+{
+    return mControlRateInference.getNumRejectedExtrapolations();
+}
+
+InferenceTelemetry& AudioPluginAudioProcessor::getTelemetry()
+{
+    return mTelemetry;
+}
+
+void AudioPluginAudioProcessor::loadModels(
+    const juce::File& encoderModel,
+    const juce::File& fcModel
+)
+{
+    auto modelTree =
+        mParameters.state.getOrCreateChildWithName("model", nullptr);
+    if (encoderModel != juce::File())
+    {
+        modelTree.setProperty(
+            "encoder",
+            encoderModel.getFullPathName(),
+            nullptr
+        );
+    }
+    if (fcModel != juce::File())
+    {
+        modelTree.setProperty("fc", fcModel.getFullPathName(), nullptr);
+    }
+}
+
+void AudioPluginAudioProcessor::setModelTier(const juce::String& name)
+{
+    mParameters.state.getOrCreateChildWithName("model", nullptr)
+        .setProperty("tier", name, nullptr);
+}
+
+void AudioPluginAudioProcessor::setModelTierGovernor(
+    bool enabled,
+    double latencyBudgetMs,
+    int maxPendingJobs
+)
+{
+    mTierGovernor.setLatencyBudget(latencyBudgetMs);
+    mTierGovernor.setMaxPendingJobs(maxPendingJobs);
+    mParameters.state.getOrCreateChildWithName("model", nullptr)
+        .setProperty("governor", enabled, nullptr);
+}
+
+juce::String AudioPluginAudioProcessor::getActiveModelTier() const
+{
+    return mTierGovernor.getActiveTier();
+}
+
+void AudioPluginAudioProcessor::setCrossInstanceBatching(bool enabled)
+{
+    mTorchWrapperPtr->setBatchingEnabled(enabled);
+}
+
+void AudioPluginAudioProcessor::setRemoteInference(bool enabled)
+{
+    mTorchWrapperPtr->setRemoteInferenceEnabled(enabled);
+}
+
+void AudioPluginAudioProcessor::setAudioThreadParameterPolling(bool enabled)
+{
+    mTorchWrapperPtr->setAudioThreadPollingEnabled(enabled);
+}
+
+void AudioPluginAudioProcessor::setOfflineSynchronousInference(bool enabled)
+{
+    mOfflineSynchronous = enabled;
+}
+
+void AudioPluginAudioProcessor::setOfflineLookahead(int numBlocks)
+{
+    mLookaheadBlocks = std::max(numBlocks, 0);
+}
+
+void AudioPluginAudioProcessor::setSpeculativePrefetch(bool enabled)
+{
+    mTorchWrapperPtr->setPrefetchEnabled(enabled);
+}
+
 juce::AudioProcessorValueTreeState::ParameterLayout
     AudioPluginAudioProcessor::createParameterLayout()
 {
@@ -390,6 +834,17 @@ juce::AudioProcessorValueTreeState::ParameterLayout
         0.0f  // default value
     ));
 
+    layout.add(std::make_unique<juce::AudioParameterFloat>(
+        "morph",                         // parameterID
+        "Shape Morph",                   // parameter name
+        juce::NormalisableRange<float>(  // range
+            0.0f,
+            1.0f,
+            0.01f
+        ),    // min, max, interval
+        0.0f  // default value
+    ));
+
     return layout;
 }
 
@@ -426,6 +881,12 @@ void AudioPluginAudioProcessor::createAndAppendValueTree()
     verticesTree.setProperty("value", vertices, nullptr);
 
     mParameters.state.appendChild(verticesTree, nullptr);
+
+    // the stored shapes the morph parameter moves through, after the
+    // current one
+    juce::ValueTree morphTree("morph");
+    morphTree.setProperty("slots", juce::Array<juce::var>(), nullptr);
+    mParameters.state.appendChild(morphTree, nullptr);
 }
 
 //==============================================================================
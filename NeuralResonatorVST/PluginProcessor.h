@@ -7,6 +7,9 @@
 #include "ProcessorIf.h"
 #include "Filterbank.h"
 #include "ParameterSyncer.h"
+#include "ControlRateInference.h"
+#include "InferenceTelemetry.h"
+#include "ModelTierGovernor.h"
 //==============================================================================
 class AudioPluginAudioProcessor : public juce::AudioProcessor,
                                   public ProcessorIf
@@ -51,7 +54,150 @@ public:
 public:
     void coefficentsChanged(const std::vector<float>& coeffs) override;
     void handleCoefficentsChanged(const std::vector<float>& coeffs);
-    QueueThread mQueueThread{"plugin_processor"};
+    void fcPrefixChanged(
+        std::shared_ptr<const MLPEvaluator> evaluator,
+        const std::vector<float>& prefix
+    ) override;
+
+    /**
+     * @brief  Evaluate the fc network on the audio thread at control rate
+     * @note   When enabled, processBlock reads the parameters every
+     * intervalSamples samples and, if they changed, evaluates the native fc
+     * network itself instead of waiting for the torch thread. Shape changes
+     * still go through the torch thread. Off by default, and without effect
+     * if the fc network is not supported natively.
+     * @param  enabled: whether the audio thread evaluates the fc network
+     * @param  intervalSamples: evaluation interval in samples
+     */
+    void setAudioThreadInference(bool enabled, int intervalSamples = 32);
+
+    /**
+     * @brief  Worst case cost of one audio thread evaluation in microseconds
+     */
+    double getAudioThreadInferenceWorstCase() const;
+
+    void linearizationChanged(
+        const CoefficientLinearization& linearization
+    ) override;
+
+    /**
+     * @brief  Extrapolate the coefficients on the audio thread
+     * @note   When enabled, the torch thread linearizes the fc network after
+     * every prediction and processBlock extrapolates from it while the next
+     * prediction is on its way. The extrapolation is skipped when the
+     * parameters moved further than maxDelta, when the estimated error
+     * exceeds maxError or when a biquad would become unstable. Only used if
+     * the fc network is not evaluated on the audio thread directly.
+     * @param  enabled: whether to extrapolate
+     * @param  maxDelta: max parameter change from the linearization point
+     * @param  maxError: max estimated coefficient error
+     */
+    void setCoefficientExtrapolation(
+        bool enabled,
+        float maxDelta = 0.1f,
+        float maxError = 0.01f
+    );
+    uint64_t getNumRejectedExtrapolations() const;
+
+    /**
+     * @brief  Swap in a new encoder and fc network
+     * @note   The paths are stored in the model tree of the state, so they
+     * are saved with it, and the torch wrapper loads, validates and swaps
+     * them in the background. A default file keeps the current model.
+     */
+    void loadModels(
+        const juce::File& encoderModel,
+        const juce::File& fcModel
+    );
+
+    /**
+     * @brief  Run the tier of the ModelRegistry with the given name
+     * @note   Stored in the model tree. An empty name follows the global
+     * tier of the registry. The bundled models are registered as "full".
+     */
+    void setModelTier(const juce::String& name);
+
+    /**
+     * @brief  Let the governor trade accuracy for responsiveness
+     * @note   While enabled, the selected tier is the highest one used, see
+     * ModelTierGovernor
+     * @param  enabled: whether to govern the tier
+     * @param  latencyBudgetMs: mean encoder plus fc latency to stay under
+     * @param  maxPendingJobs: queued inference jobs to stay under
+     */
+    void setModelTierGovernor(
+        bool enabled,
+        double latencyBudgetMs = 50.0,
+        int maxPendingJobs = 4
+    );
+    juce::String getActiveModelTier() const;
+
+    /**
+     * @brief  Share batched fc forwards with the other instances
+     * @note   See TorchWrapper::setBatchingEnabled. The batching window is
+     * process wide, set on the shared InferenceBatcher.
+     */
+    void setCrossInstanceBatching(bool enabled);
+
+    /**
+     * @brief  Run the models in the out-of-process inference host
+     * @note   See TorchWrapper::setRemoteInferenceEnabled. The host is the
+     * NeuralResonatorInferenceHost executable, it is not launched by the
+     * plugin. To keep the models out of the plugin process as well, enable
+     * TorchWrapper::setRemoteInferenceDefault before creating the instance.
+     */
+    void setRemoteInference(bool enabled);
+
+    /**
+     * @brief  Drive inference from the parameters the audio thread sees
+     * @note   See TorchWrapper::setAudioThreadPollingEnabled. For hosts that
+     * block the message thread while they render.
+     */
+    void setAudioThreadParameterPolling(bool enabled);
+
+    /**
+     * @brief  Predict inline while the host renders offline
+     * @note   Enabled by default. While isNonRealtime() is true and the
+     * audio thread does not evaluate the fc network itself, processBlock
+     * checks the parameters at the start of every block, and after a change
+     * waits for TorchWrapper::predictSynchronously and applies the result
+     * at that sample. Coefficients predicted in the background are ignored
+     * meanwhile, so a render is reproducible and can run faster than real
+     * time without missing automation. After a failed or timed out
+     * prediction the background predictions take over until the next
+     * prepareToPlay, so a stuck lane stalls the render only once.
+     * Offline renders never extrapolate from the linearization.
+     */
+    void setOfflineSynchronousInference(bool enabled);
+
+    /**
+     * @brief  Look ahead by a number of blocks during offline renders
+     * @note   Takes effect at the next prepareToPlay of an offline
+     * render. The audio is delayed by numBlocks times the block size,
+     * which is reported as latency, so the parameters of the next
+     * numBlocks blocks are known before their audio is processed. The
+     * changes among them are predicted with one batched fc forward
+     * (TorchWrapper::predictBatchSynchronously) and every frame is applied
+     * at the sample its change happened at. Real time playback is neither
+     * delayed nor looks ahead, its coefficients would be heard early.
+     * 0 disables the lookahead.
+     */
+    void setOfflineLookahead(int numBlocks);
+
+    /**
+     * @brief  Prefetch the neighbours of the latest parameter change into
+     * the coefficient cache, see TorchWrapper::setPrefetchEnabled. Off by
+     * default.
+     */
+    void setSpeculativePrefetch(bool enabled);
+
+    /**
+     * @brief  Per stage latency histograms of the inference pipeline
+     * @note   A summary is also logged periodically, see
+     * InferenceTelemetry::setSummaryInterval
+     */
+    InferenceTelemetry& getTelemetry() override;
+    TaskStrand mStrand{"plugin_processor"};
 
     std::map<juce::String, juce::String> mConfigMap;
     juce::File mIndexFile;
@@ -64,12 +210,65 @@ private:
     juce::AudioProcessorValueTreeState::ParameterLayout createParameterLayout(
     );
     void createAndAppendValueTree();
+    void applyCoefficients(const std::vector<float>& coefficients);
+    void predictBlockSynchronously();
+    void synchronousPredictionFailed();
+    void delayForLookahead(juce::AudioBuffer<float>& buffer);
+    void collectLookaheadState(int64_t blockPosition, int numSamples);
+    void predictLookaheadStates();
+    void processLookaheadFrames(
+        juce::AudioBuffer<float>& buffer,
+        int64_t blockPosition
+    );
+    void popLookaheadFrame();
 
 private:
     std::unique_ptr<juce::FileLogger> mFileLoggerPtr;
     Filterbank mFilterbank;
     // We need this to be able to set the coefficients of the IIR filters at first without interpolation
-    bool firstCoefficients = true;
+    // set from the processor strand and the audio thread
+    std::atomic<bool> firstCoefficients{true};
+
+    InferenceTelemetry mTelemetry;
+    // when the last coefficients reached the filterbank, 0 once picked up
+    std::atomic<int64_t> mCoefficientsAppliedTicks{0};
+
+    ControlRateInference mControlRateInference;
+    std::vector<float> mControlRateCoefficients;
+    int mSamplesUntilInference = 0;
+    // samples processed since prepareToPlay, the audio timeline
+    int64_t mSamplePosition = 0;
+
+    // offline rendering, see setOfflineSynchronousInference
+    std::atomic<bool> mOfflineSynchronous{true};
+    std::atomic<bool> mRenderingSynchronously{false};
+    // a synchronous prediction failed, audio thread only
+    bool mSynchronousFailed = false;
+    ResonatorState mSynchronousState;
+    bool mHasSynchronousState = false;
+    std::vector<float> mSynchronousCoefficients;
+
+    // offline lookahead, see setOfflineLookahead. The states wait for
+    // their batched prediction, the frames for their sample in a ring
+    // that is allocated in prepareToPlay.
+    struct LookaheadFrame
+    {
+        int64_t samplePosition;
+        std::vector<float> coefficients;
+    };
+    std::atomic<int> mLookaheadBlocks{0};
+    int mLookaheadBatchSize = 0;
+    int mLookaheadSamples = 0;
+    juce::AudioBuffer<float> mLookaheadBuffer;
+    int mLookaheadWritePosition = 0;
+    std::vector<int64_t> mLookaheadPositions;
+    std::vector<ResonatorState> mLookaheadStates;
+    std::vector<float> mLookaheadCoefficients;
+    std::vector<LookaheadFrame> mLookaheadFrames;
+    size_t mLookaheadFrameRead = 0;
+    size_t mLookaheadFrameCount = 0;
+
+    ModelTierGovernor mTierGovernor;
 
 private:
     //==============================================================================
@@ -1,9 +1,40 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 
+class MLPEvaluator;
+class InferenceTelemetry;
+struct CoefficientLinearization;
+
 class ProcessorIf
 {
 public:
     virtual void coefficentsChanged(const std::vector<float>& coeffs) = 0;
-};
\ No newline at end of file
+
+    /**
+     * @brief  Called from the torch thread when the native fc evaluator or
+     * the cached feature part of its first layer changes
+     * @param  evaluator: the native evaluator, or nullptr if there is none
+     * @param  prefix: the feature part of the first layer
+     */
+    virtual void fcPrefixChanged(
+        std::shared_ptr<const MLPEvaluator> evaluator,
+        const std::vector<float>& prefix
+    ) = 0;
+
+    /**
+     * @brief  Called from the torch thread with the jacobian of the fc
+     * network at the latest parameters, or with an empty linearization
+     * when the shape or the model changed
+     */
+    virtual void linearizationChanged(
+        const CoefficientLinearization& linearization
+    ) = 0;
+
+    /**
+     * @brief  Latency histograms of this instance, safe to record into from
+     * any thread
+     */
+    virtual InferenceTelemetry& getTelemetry() = 0;
+};
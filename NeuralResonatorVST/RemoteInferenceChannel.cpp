@@ -0,0 +1,177 @@
+#include "RemoteInferenceChannel.h"
+#include "HelperFunctions.h"
+#include <algorithm>
+#include <thread>
+
+RemoteInferenceChannel::Heartbeat::Heartbeat()
+{
+    mStrand.post([this] { beat(); });
+}
+
+RemoteInferenceChannel::Heartbeat::~Heartbeat()
+{
+    mStrand.stop();
+}
+
+void RemoteInferenceChannel::Heartbeat::add(RemoteProtocol::Channel* channel)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    channel->clientHeartbeat = juce::Time::currentTimeMillis();
+    mChannels.push_back(channel);
+}
+
+void RemoteInferenceChannel::Heartbeat::remove(
+    RemoteProtocol::Channel* channel
+)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    mChannels.erase(
+        std::remove(mChannels.begin(), mChannels.end(), channel),
+        mChannels.end()
+    );
+}
+
+void RemoteInferenceChannel::Heartbeat::beat()
+{
+    {
+        std::lock_guard<std::mutex> lock(mLock);
+        auto now = juce::Time::currentTimeMillis();
+        for (auto channel : mChannels) { channel->clientHeartbeat = now; }
+    }
+    mStrand.postAfter(
+        int(RemoteProtocol::kHeartbeatIntervalMs),
+        [this] { beat(); }
+    );
+}
+
+RemoteInferenceChannel::RemoteInferenceChannel(
+    RemoteProtocol::ModelKind modelKind
+)
+    : mSlot(std::make_unique<RemoteProtocol::Slot>())
+{
+    auto directory = RemoteProtocol::getChannelDirectory();
+    directory.createDirectory();
+    mFile = directory.getChildFile(juce::Uuid().toString() + ".channel");
+
+    // the file has the size of the channel and starts zeroed
+    {
+        juce::FileOutputStream stream(mFile);
+        if (!stream.openedOk())
+        {
+            JLOG("Could not create the channel " + mFile.getFullPathName());
+            return;
+        }
+        stream.writeRepeatedByte(0, sizeof(RemoteProtocol::Channel));
+        stream.flush();
+    }
+
+    mMapping = std::make_unique<juce::MemoryMappedFile>(
+        mFile,
+        juce::MemoryMappedFile::readWrite,
+        false
+    );
+    if (mMapping->getData() == nullptr ||
+        mMapping->getSize() < sizeof(RemoteProtocol::Channel))
+    {
+        JLOG("Could not map the channel " + mFile.getFullPathName());
+        mMapping.reset();
+        return;
+    }
+
+    mChannel = static_cast<RemoteProtocol::Channel*>(mMapping->getData());
+    mChannel->version = RemoteProtocol::kVersion;
+    mChannel->modelKind = modelKind;
+    mHeartbeat->add(mChannel);
+    mChannel->magic.store(RemoteProtocol::kMagic, std::memory_order_release);
+}
+
+RemoteInferenceChannel::~RemoteInferenceChannel()
+{
+    // the heartbeat must not write to the unmapped channel
+    if (mChannel != nullptr) { mHeartbeat->remove(mChannel); }
+    mChannel = nullptr;
+    mMapping.reset();
+    mFile.deleteFile();
+}
+
+bool RemoteInferenceChannel::isValid() const
+{
+    return mChannel != nullptr;
+}
+
+void RemoteInferenceChannel::setModel(const juce::String& modelPath)
+{
+    if (mChannel == nullptr) { return; }
+
+    // the host copies the path and checks that the generation did not
+    // change meanwhile
+    auto path = modelPath.toStdString();
+    auto length = std::min(
+        path.size(),
+        size_t(RemoteProtocol::kMaxPathLength - 1)
+    );
+    std::memcpy(mChannel->modelPath, path.data(), length);
+    mChannel->modelPath[length] = '\0';
+    mChannel->modelGeneration.fetch_add(1, std::memory_order_release);
+}
+
+bool RemoteInferenceChannel::isConnected() const
+{
+    if (mChannel == nullptr) { return false; }
+
+    auto now = juce::Time::currentTimeMillis();
+    return now - mChannel->hostHeartbeat.load() <
+           RemoteProtocol::kHeartbeatTimeoutMs;
+}
+
+bool RemoteInferenceChannel::call(
+    const float* input,
+    size_t numInputs,
+    float* output,
+    size_t numOutputs,
+    int timeoutMs
+)
+{
+    if (numInputs > size_t(RemoteProtocol::kMaxValues) || !isConnected())
+    {
+        return false;
+    }
+
+    // responses to requests that timed out earlier
+    auto& slot = *mSlot;
+    while (RemoteProtocol::pop(mChannel->responses, slot)) {}
+
+    slot.sequence = ++mSequence;
+    slot.status = RemoteProtocol::Status::Ok;
+    slot.numValues = uint32_t(numInputs);
+    std::memcpy(slot.values, input, numInputs * sizeof(float));
+    if (!RemoteProtocol::push(mChannel->requests, slot)) { return false; }
+
+    auto deadline = juce::Time::getMillisecondCounterHiRes() + timeoutMs;
+    for (int spins = 0;; spins++)
+    {
+        if (RemoteProtocol::pop(mChannel->responses, slot))
+        {
+            if (slot.sequence != mSequence) { continue; }
+            if (slot.status != RemoteProtocol::Status::Ok ||
+                slot.numValues != numOutputs)
+            {
+                JLOG(
+                    "Inference host failed with status " +
+                    std::to_string(int(slot.status))
+                );
+                return false;
+            }
+            std::memcpy(output, slot.values, numOutputs * sizeof(float));
+            return true;
+        }
+
+        if (juce::Time::getMillisecondCounterHiRes() > deadline)
+        {
+            JLOG("Inference host timed out");
+            return false;
+        }
+        if (spins < kNumSpins) { std::this_thread::yield(); }
+        else { juce::Thread::sleep(1); }
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "RemoteProtocol.h"
+#include "TaskExecutor.h"
+
+#include <juce_core/juce_core.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief  Plugin side of one shared memory channel to the inference host
+ * @note   Owned and used by a single inference lane. call writes a request
+ * and waits for its response. It returns false right away while the host
+ * is not running, and after the timeout if the host stops answering, so
+ * the lane can fall back to in-process inference. The host picks the
+ * channel up whenever it (re)starts, so reconnecting needs nothing from
+ * this side. The heartbeat of this side is written by a shared timed job,
+ * so the host can tell an idle plugin from a crashed one.
+ */
+class RemoteInferenceChannel
+{
+public:
+    explicit RemoteInferenceChannel(RemoteProtocol::ModelKind modelKind);
+    ~RemoteInferenceChannel();
+
+    /**
+     * @brief  Whether the channel file could be created and mapped
+     */
+    bool isValid() const;
+
+    /**
+     * @brief  Tell the host which model file to serve this channel with
+     */
+    void setModel(const juce::String& modelPath);
+
+    /**
+     * @brief  Whether the host heartbeat is recent
+     */
+    bool isConnected() const;
+
+    /**
+     * @brief  Run the model of the channel in the host
+     * @param  input: numInputs floats
+     * @param  output: numOutputs floats, only written on success
+     * @param  timeoutMs: how long to wait for the response
+     * @retval false if the host is gone, busy or failed
+     */
+    bool call(
+        const float* input,
+        size_t numInputs,
+        float* output,
+        size_t numOutputs,
+        int timeoutMs
+    );
+
+private:
+    /**
+     * @brief  Writes the plugin heartbeat of every channel of the process
+     * @note   Shared through juce::SharedResourcePointer, a background
+     * job on the shared TaskExecutor that posts itself again every
+     * kHeartbeatIntervalMs.
+     */
+    class Heartbeat
+    {
+    public:
+        Heartbeat();
+        ~Heartbeat();
+
+        void add(RemoteProtocol::Channel* channel);
+        void remove(RemoteProtocol::Channel* channel);
+
+    private:
+        void beat();
+
+        std::mutex mLock;
+        std::vector<RemoteProtocol::Channel*> mChannels;
+
+        // last, so no beat runs on a half destroyed heartbeat
+        TaskStrand mStrand{"inference_heartbeat", TaskPriority::Background};
+    };
+
+    // yields before sleeping while waiting for a response
+    static constexpr int kNumSpins = 1000;
+
+    juce::SharedResourcePointer<Heartbeat> mHeartbeat;
+    juce::File mFile;
+    std::unique_ptr<juce::MemoryMappedFile> mMapping;
+    RemoteProtocol::Channel* mChannel = nullptr;
+    uint32_t mSequence = 0;
+
+    // a slot is 4 kB, so it is kept off the stack
+    std::unique_ptr<RemoteProtocol::Slot> mSlot;
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(RemoteInferenceChannel)
+};
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * @brief  Shared memory layout between the plugin and the inference host
+ * @note   Every inference lane of a plugin instance owns one channel, a
+ * memory mapped file in getChannelDirectory(). The host process discovers
+ * the channel files, loads the model named in the channel and serves its
+ * request ring, writing the outputs (features or coefficient frames) into
+ * the response ring. Both rings are single producer single consumer, so
+ * only the indices are atomic. Heartbeats are wall clock milliseconds, a
+ * side whose heartbeat is older than kHeartbeatTimeoutMs is considered
+ * gone. The host deletes the channels whose plugin heartbeat is older than
+ * kClientTimeoutMs, they were left behind by a crashed plugin.
+ */
+class RemoteProtocol
+{
+public:
+    static constexpr uint32_t kMagic = 0x4e524948;  // "NRIH"
+    // bump when the layout changes, the host ignores other versions
+    static constexpr uint32_t kVersion = 1;
+
+    static constexpr int kMaxPathLength = 1024;
+    static constexpr int kRingSize = 4;
+    // the fc input is the largest payload: features, position and material
+    static constexpr int kMaxValues = 1000 + 2 + 5;
+    static constexpr int64_t kHeartbeatIntervalMs = 100;
+    static constexpr int64_t kHeartbeatTimeoutMs = 1000;
+    // generous, a plugin host may stall for a while, e.g. in a debugger
+    static constexpr int64_t kClientTimeoutMs = 10000;
+
+    enum class ModelKind : uint32_t
+    {
+        Encoder = 1,
+        FC = 2
+    };
+
+    enum class Status : int32_t
+    {
+        Ok = 0,
+        ModelNotLoaded = 1,
+        InvalidRequest = 2,
+        InferenceFailed = 3
+    };
+
+    struct Slot
+    {
+        uint32_t sequence;
+        Status status;
+        uint32_t numValues;
+        // encoder: interleaved vertices in pixels in, features out
+        // fc: fc input row in, coefficients out
+        float values[kMaxValues];
+    };
+
+    struct Ring
+    {
+        std::atomic<uint32_t> writeIndex;
+        std::atomic<uint32_t> readIndex;
+        Slot slots[kRingSize];
+    };
+
+    struct Channel
+    {
+        // written last by the plugin, once the rest is initialised
+        std::atomic<uint32_t> magic;
+        uint32_t version;
+        ModelKind modelKind;
+
+        // the plugin writes the path, then bumps the generation
+        std::atomic<uint32_t> modelGeneration;
+        char modelPath[kMaxPathLength];
+
+        std::atomic<int64_t> clientHeartbeat;
+        std::atomic<int64_t> hostHeartbeat;
+
+        Ring requests;
+        Ring responses;
+    };
+
+    static_assert(
+        std::atomic<uint32_t>::is_always_lock_free &&
+            std::atomic<int64_t>::is_always_lock_free,
+        "the channel atomics are shared between processes"
+    );
+
+    /**
+     * @brief  Where the plugin creates its channel files
+     */
+    static juce::File getChannelDirectory()
+    {
+        return juce::File::getSpecialLocation(juce::File::tempDirectory)
+            .getChildFile("NeuralResonatorInference");
+    }
+
+    /**
+     * @brief  Copy a slot into a ring
+     * @retval false if the ring is full
+     */
+    static bool push(Ring& ring, const Slot& slot)
+    {
+        auto write = ring.writeIndex.load(std::memory_order_relaxed);
+        auto read = ring.readIndex.load(std::memory_order_acquire);
+        if (write - read >= uint32_t(kRingSize)) { return false; }
+
+        auto& dest = ring.slots[write % kRingSize];
+        dest.sequence = slot.sequence;
+        dest.status = slot.status;
+        dest.numValues = std::min<uint32_t>(slot.numValues, kMaxValues);
+        std::memcpy(dest.values, slot.values, dest.numValues * sizeof(float));
+        ring.writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * @brief  Copy the oldest slot out of a ring
+     * @retval false if the ring is empty
+     */
+    static bool pop(Ring& ring, Slot& slot)
+    {
+        auto read = ring.readIndex.load(std::memory_order_relaxed);
+        auto write = ring.writeIndex.load(std::memory_order_acquire);
+        if (read == write) { return false; }
+
+        const auto& src = ring.slots[read % kRingSize];
+        slot.sequence = src.sequence;
+        slot.status = src.status;
+        slot.numValues = std::min<uint32_t>(src.numValues, kMaxValues);
+        std::memcpy(slot.values, src.values, slot.numValues * sizeof(float));
+        ring.readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+};
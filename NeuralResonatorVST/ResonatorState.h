@@ -0,0 +1,99 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+
+/**
+ * @brief  The parameters of the resonator as the fc network sees them
+ * @note   position and material are laid out like the parameter part of
+ * the fc input, so they are copied into it in one go. The position is in
+ * the [0, 1] space of the network with the origin in the top left corner.
+ */
+struct ResonatorState
+{
+    float position[2] = {0.5f, 0.5f};
+    float material[5] = {0.5f, 0.5f, 0.5f, 0.5f, 0.5f};
+    float morph = 0.0f;
+};
+
+static_assert(
+    std::is_trivially_copyable<ResonatorState>::value,
+    "ResonatorState is copied word by word"
+);
+
+/**
+ * @brief  Seqlock around a ResonatorState, one writer, any number of readers
+ * @note   The writer never waits, a reader retries if it overlapped a write.
+ * The words are relaxed atomics so a torn read is detected by the version
+ * instead of being undefined behaviour. A reader that keeps overlapping
+ * yields, so it does not keep a preempted writer from finishing.
+ */
+class ResonatorStateLock
+{
+public:
+    ResonatorStateLock() { write(ResonatorState()); }
+
+    /**
+     * @brief  Publish a new state, single writer only
+     */
+    void write(const ResonatorState& state)
+    {
+        float words[kNumWords];
+        std::memcpy(words, &state, sizeof(ResonatorState));
+
+        auto sequence = mSequence.load(std::memory_order_relaxed);
+        mSequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (size_t i = 0; i < kNumWords; i++)
+        {
+            mWords[i].store(words[i], std::memory_order_relaxed);
+        }
+        mSequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    /**
+     * @brief  Read a consistent copy of the latest state
+     * @retval the version of the copy, it grows with every write
+     */
+    uint64_t read(ResonatorState& state) const
+    {
+        float words[kNumWords];
+        for (int spins = 0;; spins++)
+        {
+            if (spins >= kNumSpins) { std::this_thread::yield(); }
+
+            auto before = mSequence.load(std::memory_order_acquire);
+            if (before & 1u) { continue; }
+            for (size_t i = 0; i < kNumWords; i++)
+            {
+                words[i] = mWords[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (mSequence.load(std::memory_order_relaxed) == before)
+            {
+                std::memcpy(&state, words, sizeof(ResonatorState));
+                return before / 2;
+            }
+        }
+    }
+
+    uint64_t getVersion() const { return mSequence.load() / 2; }
+
+private:
+    static constexpr size_t kNumWords =
+        sizeof(ResonatorState) / sizeof(float);
+    static_assert(kNumWords * sizeof(float) == sizeof(ResonatorState));
+    // retries before a reader starts yielding
+    static constexpr int kNumSpins = 64;
+
+    std::atomic<uint64_t> mSequence{0};
+    std::array<std::atomic<float>, kNumWords> mWords;
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ResonatorStateLock)
+};
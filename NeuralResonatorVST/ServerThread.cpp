@@ -5,16 +5,20 @@ ServerThread::ServerThread(
     ParameterSyncerIf *parameterSyncerIf,
     unsigned short port
 )
-    : juce::Thread("Server Thread")
-    , mParameterSyncerIfPtr(parameterSyncerIf)
+    : mParameterSyncerIfPtr(parameterSyncerIf)
 {
-    addListener(this);
-
+    mServer.io_service = mExecutor->getIoService();
     mServer.config.port = port;
     auto &endpoint = mServer.endpoint["^/ui/?$"];
 
     endpoint.on_message = [this](auto connection, auto in_message)
-    { this->onMessage(connection, in_message); };
+    {
+        // the message is only valid during the handler
+        mStrand.post(
+            [this, connection, message = in_message->string()]
+            { onMessage(connection, message); }
+        );
+    };
 
     endpoint.on_open = [this](auto connection) { this->onOpen(connection); };
     endpoint.on_close =
@@ -24,42 +28,55 @@ ServerThread::ServerThread(
 
 ServerThread::~ServerThread()
 {
-    // allow 100ms for the thread to stop cleanly
-    stopThread(100);
+    // drop the queued messages, then no handler runs past this point
+    mStrand.stop();
+    mServer.shutdown();
+    JLOG("WS Server: Stopped");
 }
 
-void ServerThread::exitSignalSent()
+void ServerThread::Server::shutdown()
 {
-    mServer.stop();
-    mConnections.clear();
+    handler_runner->stop();
+    stop();
 }
 
-void ServerThread::run()
+void ServerThread::start()
 {
-    // Start server and receive assigned port when server is listening for
-    // requests
-
-    // recursively try to find a port that is not in use
-    while (checkPortInUse(mServer.config.port))
-    {
-        JLOG(
-            "WS Server: Port " + juce::String(mServer.config.port) + " in use"
-        );
-        mServer.config.port++;
-    }
+    mStrand.post(
+        [this]
+        {
+            // try to find a port that is not in use
+            while (checkPortInUse(mServer.config.port))
+            {
+                JLOG(
+                    "WS Server: Port " + juce::String(mServer.config.port) +
+                    " in use"
+                );
+                mServer.config.port++;
+            }
 
-    mServer.start(mOnStartCallback);
+            // with an external io_service start only opens the acceptor
+            try
+            {
+                mServer.start();
+            }
+            catch (const std::exception &e)
+            {
+                JLOG("WS Server: Failed to start. " + juce::String(e.what()));
+                return;
+            }
 
-    // Wait for server to stop
-    JLOG("WS Server: Stopped");
+            if (mOnStartCallback) { mOnStartCallback(mServer.config.port); }
+        }
+    );
 }
 
 void ServerThread::onMessage(
     std::shared_ptr<WsServer::Connection> connection,
-    std::shared_ptr<WsServer::InMessage> in_message
+    const std::string &message
 )
 {
-    auto out_message = in_message->string();
+    const auto &out_message = message;
 
     // std::cout << "Server: Message received: \"" << out_message << "\" from
     // "
@@ -90,6 +107,12 @@ void ServerThread::onMessage(
 
         mParameterSyncerIfPtr->receivedShapeUpdate(parsedJson);
     }
+    else if (messageType == "load_model")
+    {
+        JLOG("Server: received model paths");
+
+        mParameterSyncerIfPtr->receivedLoadModel(parsedJson);
+    }
 
 #if 0
     auto parsedJson = JSON::parse(out_message);
@@ -178,9 +201,12 @@ void ServerThread::onOpen(ConnectionPtr connection)
     JLOG("Server: Opened connection " + ss.str());
 
     // add connection to the list of active connections
-    mConnections.push_back(connection);
+    {
+        std::lock_guard<std::mutex> lock(mConnectionsLock);
+        mConnections.push_back(connection);
+    }
 
-    mParameterSyncerIfPtr->onOpen();
+    mStrand.post([this] { mParameterSyncerIfPtr->onOpen(); });
 }
 
 void ServerThread::onClose(
@@ -195,6 +221,7 @@ void ServerThread::onClose(
     // JLOG("Server: Closed connection " + ss.str() +
     //  " with status code " + juce::String(status));
     // remove connection from the list of active connections
+    std::lock_guard<std::mutex> lock(mConnectionsLock);
     auto it = std::find(mConnections.begin(), mConnections.end(), connection);
     if (it != mConnections.end()) { mConnections.erase(it); }
 }
@@ -206,8 +233,14 @@ ServerThreadIf *ServerThread::getServerThreadIfPtr()
 
 void ServerThread::sendMessage(const juce::String &message)
 {
+    std::vector<ConnectionPtr> connections;
+    {
+        std::lock_guard<std::mutex> lock(mConnectionsLock);
+        connections = mConnections;
+    }
+
     // send message to all connections
-    for (auto &connection : mConnections)
+    for (auto &connection : connections)
     {
         // connection->send is an asynchronous function
         connection->send(
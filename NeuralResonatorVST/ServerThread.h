@@ -3,38 +3,58 @@
 #include <juce_core/juce_core.h>
 #include <juce_gui_basics/juce_gui_basics.h>
 #include <functional>
+#include <mutex>
 #include "simple_ws_server/server_ws.hpp"
 
 #include "ParameterSyncerIf.h"
 #include "ServerThreadIf.h"
+#include "TaskExecutor.h"
 
 using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
 using ConnectionPtr = std::shared_ptr<WsServer::Connection>;
 using MessagePtr = std::shared_ptr<WsServer::InMessage>;
 
-class ServerThread : public juce::Thread,
-                     public juce::Thread::Listener,
-                     public ServerThreadIf
+/**
+ * @brief  Websocket server of an editor
+ * @note   It has no thread of its own anymore, the sockets run on the
+ * io_service of the shared TaskExecutor. The asio handlers only read the
+ * messages, the editor side work runs in order on the ui strand.
+ */
+class ServerThread : public ServerThreadIf
 {
 public:
     ServerThread(ParameterSyncerIf *parameterSyncerIf,
                  unsigned short port = 8000);
     ~ServerThread();
 
-    void run() override;
+    /**
+     * @brief  Find a free port and start listening, the start callback
+     * runs on the ui strand once it does
+     */
+    void start();
 
     void sendMessage(const juce::String &message) override;
     ServerThreadIf *getServerThreadIfPtr() override;
 
     void setOnStartCallback(std::function<void(unsigned short)> callback);
 private:
+    // cancels the handlers of its connections when shut down, they may
+    // still be queued on the shared io_service
+    class Server : public WsServer
+    {
+    public:
+        void shutdown();
+    };
+
     ParameterSyncerIf *mParameterSyncerIfPtr;
 
-    WsServer mServer;
+    juce::SharedResourcePointer<TaskExecutor> mExecutor;
+    Server mServer;
+    // the handlers run on any worker
+    std::mutex mConnectionsLock;
     std::vector<ConnectionPtr> mConnections;
 
-    void exitSignalSent() override;
-    void onMessage(ConnectionPtr connection, MessagePtr in_message);
+    void onMessage(ConnectionPtr connection, const std::string &message);
 
     std::function<void(unsigned short)> mOnStartCallback;
 
@@ -44,5 +64,8 @@ private:
 
     bool checkPortInUse(unsigned short port);
 
+    // last, so no job runs on a half destroyed server
+    TaskStrand mStrand{"ui_server", TaskPriority::Interactive};
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(ServerThread)
 };
\ No newline at end of file
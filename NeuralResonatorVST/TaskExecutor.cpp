@@ -0,0 +1,471 @@
+#include "TaskExecutor.h"
+#include "HelperFunctions.h"
+#include <asio/steady_timer.hpp>
+#include <algorithm>
+#include <chrono>
+
+void TaskQueues::push(
+    TaskPriority priority,
+    std::function<void()> task,
+    bool counted
+)
+{
+    mQueues[size_t(priority)].push_back(
+        {std::move(task), juce::Time::getHighResolutionTicks(), counted}
+    );
+}
+
+bool TaskQueues::pop(Entry &entry, bool interactiveOnly)
+{
+    int numClasses = interactiveOnly ? 1 : kNumPriorities;
+    auto getHighest = [this, numClasses]
+    {
+        int p = 0;
+        while (p < numClasses && mQueues[size_t(p)].empty()) { p++; }
+        return p < numClasses ? p : kNumPriorities;
+    };
+
+    auto now = juce::Time::getHighResolutionTicks();
+    auto getWaitMs = [now](const Pending &pending)
+    {
+        return 1000.0 *
+               juce::Time::highResolutionTicksToSeconds(
+                   now - pending.queuedTicks
+               );
+    };
+
+    // a starving task goes first, the most urgent class of them
+    int index = -1;
+    for (int p = 1; p < numClasses && index < 0; p++)
+    {
+        const auto &queue = mQueues[size_t(p)];
+        if (!queue.empty() &&
+            getWaitMs(queue.front()) >
+                getStarvationLimitMs(TaskPriority(p)))
+        {
+            index = p;
+        }
+    }
+
+    // only promoted if it actually overtook something
+    bool promoted = false;
+    if (index >= 0) { promoted = getHighest() < index; }
+    else { index = getHighest(); }
+    if (index == kNumPriorities) { return false; }
+
+    auto &queue = mQueues[size_t(index)];
+    entry.task = std::move(queue.front().task);
+    entry.priority = TaskPriority(index);
+    entry.waitMs = getWaitMs(queue.front());
+    entry.promoted = promoted;
+    entry.counted = queue.front().counted;
+    queue.pop_front();
+    return true;
+}
+
+bool TaskQueues::isEmpty() const
+{
+    return getHighestPriority() == TaskPriority::NumPriorities;
+}
+
+int TaskQueues::getSize(TaskPriority priority) const
+{
+    return int(mQueues[size_t(priority)].size());
+}
+
+TaskPriority TaskQueues::getHighestPriority() const
+{
+    for (int p = 0; p < kNumPriorities; p++)
+    {
+        if (!mQueues[size_t(p)].empty()) { return TaskPriority(p); }
+    }
+    return TaskPriority::NumPriorities;
+}
+
+void TaskQueues::clear()
+{
+    for (auto &queue : mQueues) { queue.clear(); }
+}
+
+double TaskQueues::getStarvationLimitMs(TaskPriority priority)
+{
+    switch (priority)
+    {
+        // a new shape may wait for a few predictions of a drag
+        case TaskPriority::Encoder:
+            return 50.0;
+        // long enough to stay out of the way of a drag, short enough that
+        // a model still loads while one goes on
+        case TaskPriority::Background:
+            return 250.0;
+        default:
+            return 0.0;
+    }
+}
+
+TaskExecutor::Worker::Worker(asio::io_service &ioService, int index)
+    : juce::Thread("task_worker_" + juce::String(index)),
+      mIoService(ioService)
+{
+}
+
+void TaskExecutor::Worker::run()
+{
+    mIoService.run();
+}
+
+TaskExecutor::TaskExecutor()
+{
+    // the inference jobs are heavy, a worker per two cores leaves room for
+    // the audio threads of the host
+    int numWorkers =
+        juce::jlimit(2, 8, juce::SystemStats::getNumCpus() / 2);
+
+    // one worker always stays free for the interactive tasks
+    mMaxDeferrableRunning = std::max(1, numWorkers - 1);
+
+    mWork = std::make_unique<asio::io_service::work>(*mIoService);
+    for (int i = 0; i < numWorkers; i++)
+    {
+        mWorkers.add(new Worker(*mIoService, i))->startThread();
+    }
+    JLOG("TaskExecutor started " + juce::String(numWorkers) + " workers");
+}
+
+TaskExecutor::~TaskExecutor()
+{
+    mWork.reset();
+    mIoService->stop();
+    for (auto *worker : mWorkers) { worker->stopThread(1000); }
+}
+
+const char *TaskExecutor::getPriorityName(TaskPriority priority)
+{
+    switch (priority)
+    {
+        case TaskPriority::Interactive:
+            return "interactive";
+        case TaskPriority::Encoder:
+            return "encoder";
+        case TaskPriority::Background:
+            return "background";
+        default:
+            return "unknown";
+    }
+}
+
+void TaskExecutor::post(TaskPriority priority, std::function<void()> task)
+{
+    jobQueued(priority);
+    schedule(priority, std::move(task), true);
+}
+
+void TaskExecutor::postAfter(int delayMs, std::function<void()> task)
+{
+    auto timer = std::make_shared<asio::steady_timer>(*mIoService);
+    timer->expires_from_now(std::chrono::milliseconds(delayMs));
+    timer->async_wait(
+        [timer, task = std::move(task)](const asio::error_code &error)
+        {
+            if (!error) { task(); }
+        }
+    );
+}
+
+int TaskExecutor::getNumWorkers() const
+{
+    return mWorkers.size();
+}
+
+std::shared_ptr<asio::io_service> TaskExecutor::getIoService()
+{
+    return mIoService;
+}
+
+void TaskExecutor::setMode(Mode mode)
+{
+    int numQueued = 0;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        if (mode == mMode) { return; }
+        mMode = mode;
+        if (mode == Mode::Pool)
+        {
+            for (int p = 0; p < TaskQueues::kNumPriorities; p++)
+            {
+                numQueued += mQueues.getSize(TaskPriority(p));
+            }
+        }
+    }
+    // tasks queued for runUntilIdle have no wake up yet
+    for (int i = 0; i < numQueued; i++)
+    {
+        mIoService->post([this] { runNext(); });
+    }
+}
+
+TaskExecutor::Mode TaskExecutor::getMode() const
+{
+    return mMode;
+}
+
+int TaskExecutor::runUntilIdle()
+{
+    int numRun = 0;
+    while (runNext()) { numRun++; }
+    return numRun;
+}
+
+void TaskExecutor::schedule(
+    TaskPriority priority,
+    std::function<void()> task,
+    bool counted
+)
+{
+    auto mode = mMode.load();
+    if (mode == Mode::Inline)
+    {
+        TaskQueues::Entry entry;
+        entry.task = std::move(task);
+        entry.priority = priority;
+        entry.counted = counted;
+        run(entry);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mQueues.push(priority, std::move(task), counted);
+        mode = mMode;
+    }
+    // every task posts one wake up, whichever worker takes it runs the
+    // most urgent task at that moment. A wake up that finds the queues
+    // empty, e.g. after runUntilIdle, does nothing
+    if (mode == Mode::Pool) { mIoService->post([this] { runNext(); }); }
+}
+
+bool TaskExecutor::runNext()
+{
+    TaskQueues::Entry entry;
+    bool deferrable = false;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        bool interactiveOnly = mNumDeferrableRunning >= mMaxDeferrableRunning;
+        if (!mQueues.pop(entry, interactiveOnly)) { return false; }
+        deferrable = entry.priority != TaskPriority::Interactive;
+        if (deferrable) { mNumDeferrableRunning++; }
+    }
+    run(entry);
+    if (!deferrable) { return true; }
+
+    // the wake ups of the tasks left queued meanwhile found nothing to
+    // run, this one takes the next of them
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mQueueLock);
+        mNumDeferrableRunning--;
+        wake = mMode == Mode::Pool &&
+               mQueues.getSize(TaskPriority::Encoder) +
+                       mQueues.getSize(TaskPriority::Background) >
+                   0;
+    }
+    if (wake) { mIoService->post([this] { runNext(); }); }
+    return true;
+}
+
+void TaskExecutor::run(TaskQueues::Entry &entry)
+{
+    if (entry.counted) { jobStarted(entry); }
+    entry.task();
+}
+
+void TaskExecutor::jobQueued(TaskPriority priority)
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    auto &counters = mCounters[size_t(priority)];
+    counters.queueDepth++;
+    counters.maxQueueDepth =
+        std::max(counters.maxQueueDepth, counters.queueDepth);
+}
+
+void TaskExecutor::jobStarted(const TaskQueues::Entry &entry)
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    auto &counters = mCounters[size_t(entry.priority)];
+    counters.queueDepth--;
+    counters.numStarted++;
+    if (entry.promoted) { counters.numPromoted++; }
+    counters.totalWaitMs += entry.waitMs;
+    counters.maxWaitMs = std::max(counters.maxWaitMs, entry.waitMs);
+}
+
+void TaskExecutor::jobsDropped(TaskPriority priority, int numJobs)
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    mCounters[size_t(priority)].queueDepth -= numJobs;
+}
+
+TaskExecutor::QueueMetrics TaskExecutor::getQueueMetrics(
+    TaskPriority priority
+) const
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    const auto &counters = mCounters[size_t(priority)];
+
+    QueueMetrics metrics;
+    metrics.queueDepth = counters.queueDepth;
+    metrics.maxQueueDepth = counters.maxQueueDepth;
+    metrics.numStarted = counters.numStarted;
+    metrics.numPromoted = counters.numPromoted;
+    metrics.maxWaitMs = counters.maxWaitMs;
+    if (counters.numStarted > 0)
+    {
+        metrics.meanWaitMs =
+            counters.totalWaitMs / double(counters.numStarted);
+    }
+    return metrics;
+}
+
+juce::String TaskExecutor::getMetricsString() const
+{
+    juce::String result;
+    for (int p = 0; p < TaskQueues::kNumPriorities; p++)
+    {
+        auto priority = TaskPriority(p);
+        auto metrics = getQueueMetrics(priority);
+        result << getPriorityName(priority) << ": queue "
+               << metrics.queueDepth << " (max " << metrics.maxQueueDepth
+               << "), started " << juce::String(metrics.numStarted)
+               << ", promoted " << juce::String(metrics.numPromoted)
+               << ", wait mean " << juce::String(metrics.meanWaitMs, 2)
+               << " max " << juce::String(metrics.maxWaitMs, 2)
+               << " ms\n";
+    }
+    return result;
+}
+
+void TaskExecutor::resetMetrics()
+{
+    std::lock_guard<std::mutex> lock(mMetricsLock);
+    for (auto &counters : mCounters)
+    {
+        // the queued jobs are still to be started
+        auto queueDepth = counters.queueDepth;
+        counters = Counters();
+        counters.queueDepth = queueDepth;
+        counters.maxQueueDepth = queueDepth;
+    }
+}
+
+TaskStrand::TaskStrand(const juce::String &name, TaskPriority priority)
+    : mName(name), mPriority(priority), mState(std::make_shared<State>())
+{
+    mState->executor = mExecutor.get();
+}
+
+TaskStrand::~TaskStrand()
+{
+    stop();
+}
+
+const juce::String &TaskStrand::getName() const
+{
+    return mName;
+}
+
+void TaskStrand::post(std::function<void()> job)
+{
+    enqueue(mState, mPriority, std::move(job));
+}
+
+void TaskStrand::post(TaskPriority priority, std::function<void()> job)
+{
+    enqueue(mState, priority, std::move(job));
+}
+
+void TaskStrand::postAfter(int delayMs, std::function<void()> job)
+{
+    mExecutor->postAfter(
+        delayMs,
+        [state = mState, priority = mPriority, job = std::move(job)]()
+            mutable { enqueue(state, priority, std::move(job)); }
+    );
+}
+
+void TaskStrand::stop()
+{
+    TaskQueues dropped;
+    {
+        std::lock_guard<std::mutex> lock(mState->queueLock);
+        if (mState->stopped) { return; }
+        mState->stopped = true;
+        std::swap(dropped, mState->jobs);
+    }
+    for (int p = 0; p < TaskQueues::kNumPriorities; p++)
+    {
+        auto priority = TaskPriority(p);
+        mExecutor->jobsDropped(priority, dropped.getSize(priority));
+    }
+
+    // the running job finishes, the next one sees the flag
+    std::lock_guard<std::mutex> runLock(mState->runLock);
+    JLOG("Stopped strand: " + mName);
+}
+
+void TaskStrand::enqueue(
+    const std::shared_ptr<State> &state,
+    TaskPriority priority,
+    std::function<void()> job
+)
+{
+    {
+        std::lock_guard<std::mutex> lock(state->queueLock);
+        if (state->stopped) { return; }
+        state->jobs.push(priority, std::move(job));
+        state->executor->jobQueued(priority);
+
+        // a running strand picks the job up itself, a more urgent job
+        // does not wait behind the runner of a less urgent one
+        if (state->running || priority >= state->scheduled) { return; }
+        state->scheduled = priority;
+    }
+    state->executor->schedule(priority, [state] { runJobs(state); }, false);
+}
+
+void TaskStrand::runJobs(const std::shared_ptr<State> &state)
+{
+    {
+        // another runner of the strand came first
+        std::lock_guard<std::mutex> lock(state->queueLock);
+        if (state->running || state->stopped) { return; }
+        state->running = true;
+        state->scheduled = TaskPriority::NumPriorities;
+    }
+
+    for (int i = 0; i < kMaxJobsPerTurn; i++)
+    {
+        std::unique_lock<std::mutex> runLock(state->runLock);
+        TaskQueues::Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(state->queueLock);
+            if (state->stopped || !state->jobs.pop(entry))
+            {
+                state->running = false;
+                return;
+            }
+        }
+        state->executor->jobStarted(entry);
+        entry.task();
+    }
+
+    // give the other strands a turn, the remaining jobs run after them
+    TaskPriority next;
+    {
+        std::lock_guard<std::mutex> lock(state->queueLock);
+        state->running = false;
+        next = state->jobs.getHighestPriority();
+        if (state->stopped || next >= state->scheduled) { return; }
+        state->scheduled = next;
+    }
+    state->executor->schedule(next, [state] { runJobs(state); }, false);
+}
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <juce_core/juce_core.h>
+#include <asio.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+/**
+ * @brief  Scheduling classes of the inference work, most urgent first
+ */
+enum class TaskPriority
+{
+    // fc predictions a user is waiting for, e.g. during a knob drag
+    Interactive,
+    // rasterize and encode a new shape
+    Encoder,
+    // prefetch, disk cache writes and model loading
+    Background,
+    NumPriorities
+};
+
+/**
+ * @brief  Pending tasks by priority, not thread safe
+ * @note   The most urgent class runs first, unless the oldest task of a
+ * less urgent class waited longer than its starvation limit, then that one
+ * is promoted and runs first.
+ */
+class TaskQueues
+{
+public:
+    static constexpr int kNumPriorities = int(TaskPriority::NumPriorities);
+
+    struct Entry
+    {
+        std::function<void()> task;
+        TaskPriority priority = TaskPriority::Interactive;
+        // how long it waited, in milliseconds
+        double waitMs = 0.0;
+        // taken ahead of more urgent tasks because it waited too long
+        bool promoted = false;
+        // counted in the metrics of the executor
+        bool counted = true;
+    };
+
+    void push(
+        TaskPriority priority,
+        std::function<void()> task,
+        bool counted = true
+    );
+
+    /**
+     * @brief  Take the next task
+     * @param  interactiveOnly: leave the less urgent classes queued
+     * @retval false if there is none
+     */
+    bool pop(Entry& entry, bool interactiveOnly = false);
+
+    bool isEmpty() const;
+    int getSize(TaskPriority priority) const;
+
+    /**
+     * @brief  The most urgent class with a pending task
+     * @retval NumPriorities if there is none
+     */
+    TaskPriority getHighestPriority() const;
+
+    void clear();
+
+    /**
+     * @brief  How long a task may wait before it is promoted
+     */
+    static double getStarvationLimitMs(TaskPriority priority);
+
+private:
+    struct Pending
+    {
+        std::function<void()> task;
+        int64_t queuedTicks;
+        bool counted;
+    };
+
+    std::array<std::deque<Pending>, kNumPriorities> mQueues;
+};
+
+/**
+ * @brief  Process wide pool of worker threads
+ * @note   Every plugin instance used to own an asio io_service and a
+ * thread per component, most of them idle. All instances now share one
+ * io_service run by a few workers, any idle worker takes the next task.
+ * Components post through a TaskStrand, which keeps their jobs in order.
+ * Tasks are taken by priority, see TaskQueues. All workers but one at most
+ * run encoder and background tasks at a time, so a model that loads for
+ * seconds or an encoder waiting for the inference host never holds up the
+ * interactive ones. Shared through juce::SharedResourcePointer.
+ */
+class TaskExecutor
+{
+public:
+    /**
+     * @brief  Where the tasks run, see setMode
+     */
+    enum class Mode
+    {
+        // on the workers
+        Pool,
+        // on the thread that posts them, before post returns
+        Inline,
+        // on the thread that calls runUntilIdle
+        Manual
+    };
+
+    /**
+     * @brief  Per class counters, waits are in milliseconds
+     */
+    struct QueueMetrics
+    {
+        int queueDepth = 0;
+        int maxQueueDepth = 0;
+        uint64_t numStarted = 0;
+        uint64_t numPromoted = 0;
+        double meanWaitMs = 0.0;
+        double maxWaitMs = 0.0;
+    };
+
+    TaskExecutor();
+    ~TaskExecutor();
+
+    static const char* getPriorityName(TaskPriority priority);
+
+    /**
+     * @brief  Run a task on any worker
+     */
+    void post(TaskPriority priority, std::function<void()> task);
+
+    /**
+     * @brief  Run a task on any worker after a delay
+     */
+    void postAfter(int delayMs, std::function<void()> task);
+
+    int getNumWorkers() const;
+
+    /**
+     * @brief  The io_service the workers run, for asio based components
+     * @note   Their handlers run on the workers directly, past the queues
+     * and the priorities, so they must only hand the work on to a strand.
+     */
+    std::shared_ptr<asio::io_service> getIoService();
+
+    /**
+     * @brief  Run the tasks on the workers, inline or when stepped
+     * @note   For tests and benchmarks, set it before creating the plugin
+     * instances. Delayed tasks still wait on the workers and then run
+     * according to the mode. In inline and manual mode a job must not
+     * wait for another job, e.g. through TorchWrapper::predictSynchronously
+     * from the thread that steps the executor, and no job may stop its own
+     * strand.
+     */
+    void setMode(Mode mode);
+    Mode getMode() const;
+
+    /**
+     * @brief  Run the queued tasks on the calling thread until there are
+     * none left, including the ones they post in turn
+     * @retval the number of tasks run, strand jobs are counted by turn
+     */
+    int runUntilIdle();
+
+    /**
+     * @brief  Counters of the jobs of one class, over all strands and
+     * tasks posted directly
+     */
+    QueueMetrics getQueueMetrics(TaskPriority priority) const;
+
+    /**
+     * @brief  One line per class with its queue depth, promotions and
+     * waits
+     */
+    juce::String getMetricsString() const;
+
+    void resetMetrics();
+
+private:
+    friend class TaskStrand;
+
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker(asio::io_service& ioService, int index);
+        void run() override;
+
+    private:
+        asio::io_service& mIoService;
+    };
+
+    /**
+     * @param  counted: false for the runners of the strands, they count
+     * their jobs themselves
+     */
+    void schedule(
+        TaskPriority priority,
+        std::function<void()> task,
+        bool counted
+    );
+    /**
+     * @retval false if nothing was queued
+     */
+    bool runNext();
+    void run(TaskQueues::Entry& entry);
+
+    void jobQueued(TaskPriority priority);
+    void jobStarted(const TaskQueues::Entry& entry);
+    void jobsDropped(TaskPriority priority, int numJobs);
+
+    struct Counters
+    {
+        int queueDepth = 0;
+        int maxQueueDepth = 0;
+        uint64_t numStarted = 0;
+        uint64_t numPromoted = 0;
+        double totalWaitMs = 0.0;
+        double maxWaitMs = 0.0;
+    };
+
+    std::atomic<Mode> mMode{Mode::Pool};
+    std::mutex mQueueLock;
+    TaskQueues mQueues;
+    // encoder and background tasks running and how many may, under
+    // mQueueLock
+    int mNumDeferrableRunning = 0;
+    int mMaxDeferrableRunning = 1;
+
+    mutable std::mutex mMetricsLock;
+    std::array<Counters, TaskQueues::kNumPriorities> mCounters;
+
+    std::shared_ptr<asio::io_service> mIoService =
+        std::make_shared<asio::io_service>();
+    std::unique_ptr<asio::io_service::work> mWork;
+    juce::OwnedArray<Worker> mWorkers;
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TaskExecutor)
+};
+
+/**
+ * @brief  Named serial queue on the shared TaskExecutor
+ * @note   Jobs of a strand never overlap and run on whichever worker is
+ * free. Jobs of the same priority run in the order they were posted, a
+ * more urgent job overtakes the queued less urgent ones. After stop (or
+ * destruction) no job of the strand runs anymore, queued ones are
+ * dropped, so jobs may capture the owner of the strand.
+ */
+class TaskStrand
+{
+public:
+    /**
+     * @param  priority: of the jobs posted without one
+     */
+    explicit TaskStrand(
+        const juce::String& name,
+        TaskPriority priority = TaskPriority::Interactive
+    );
+    ~TaskStrand();
+
+    const juce::String& getName() const;
+
+    void post(std::function<void()> job);
+    void post(TaskPriority priority, std::function<void()> job);
+
+    /**
+     * @brief  Post a job after a delay, dropped if the strand stopped
+     * meanwhile
+     */
+    void postAfter(int delayMs, std::function<void()> job);
+
+    /**
+     * @brief  Drop the queued jobs and wait for the running one
+     * @note   Must not be called from a job of the strand itself
+     */
+    void stop();
+
+private:
+    // shared with the tasks on the executor, so they never touch a
+    // destroyed strand
+    struct State
+    {
+        TaskExecutor* executor = nullptr;
+        std::mutex queueLock;
+        TaskQueues jobs;
+        // the most urgent runner waiting on the executor, NumPriorities if
+        // there is none
+        TaskPriority scheduled = TaskPriority::NumPriorities;
+        bool running = false;
+        bool stopped = false;
+        // held while a job runs, stop waits on it
+        std::mutex runLock;
+    };
+
+    // jobs run before the strand yields its worker to other strands
+    static constexpr int kMaxJobsPerTurn = 16;
+
+    static void enqueue(
+        const std::shared_ptr<State>& state,
+        TaskPriority priority,
+        std::function<void()> job
+    );
+    static void runJobs(const std::shared_ptr<State>& state);
+
+    juce::String mName;
+    TaskPriority mPriority;
+    juce::SharedResourcePointer<TaskExecutor> mExecutor;
+    std::shared_ptr<State> mState;
+
+private:
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TaskStrand)
+};
@@ -1,9 +1,20 @@
 #include "TorchWrapper.h"
 #include "HelperFunctions.h"
+#include "ModelTransforms.h"
+#include "ModelRegistry.h"
 #include "ServerThreadIf.h"
+#include <cmath>
+#include <cstddef>
 #include <cstring>
+#include <limits>
 #include <algorithm>
 
+static std::atomic<bool> &remoteInferenceDefault()
+{
+    static std::atomic<bool> enabled{false};
+    return enabled;
+}
+
 TorchWrapper::TorchWrapper(
     ProcessorIf *processorPtr,
     juce::AudioProcessorValueTreeState &vtsRef,
@@ -13,25 +24,92 @@ TorchWrapper::TorchWrapper(
     : mVts(vtsRef)
     , mProcessorPtr(processorPtr)
 {
-    mCoefficients.resize(32 * 2 * 6);
+    mCoefficients.resize(kNumCoefficients);
 
     // initialize the tensors
+    // the input tensors are persistent: they are allocated once here and
+    // written in place before every inference. Pinning only makes sense when
+    // there is a device to transfer to.
     auto options = torch::TensorOptions()
         .dtype(torch::kFloat32)
         .device(torch::kCPU)
-        .requires_grad(false);
+        .requires_grad(false)
+        .pinned_memory(torch::cuda::is_available());
+
+    mImageTensor =
+        torch::zeros({1, 1, kImageSize, kImageSize}, options);
+
+    // the encoder expects 3 identical channels, an expanded view avoids
+    // the copy that repeat() does
+    mEncoderInputTensor =
+        mImageTensor.expand({1, kNumImageChannels, kImageSize, kImageSize});
+
+    mFCInputTensor = torch::full(
+        {1, kNumFeatures + kNumPositions + kNumMaterials},
+        0.5f,
+        options
+    );
+    mFeatureTensor = mFCInputTensor.narrow(1, 0, kNumFeatures);
 
-    mLastMaterialTensor = torch::full({1, 5}, 0.5f, options);
-    mLastPositionTensor = torch::full({1, 2}, 0.5f, options);
+    // position and material, the input of the split fc network, written
+    // straight from a ResonatorState
+    mParameterTensor = mFCInputTensor.narrow(
+        1,
+        kNumFeatures,
+        kNumPositions + kNumMaterials
+    );
+    mFeatureVector = mFeatureTensor.select(0, 0);
+    mLinearizationGradOutputs = torch::eye(kNumCoefficients);
+
+    mEncoderInputs.push_back(mEncoderInputTensor);
+    mFCInputs.push_back(mFCInputTensor);
+    mFCSplitInputs.push_back(mParameterTensor);
+
+    // load the models, unless the inference host serves them. Then they
+    // are only loaded when a lane falls back to in-process inference
+    if (getRemoteInferenceDefault())
+    {
+        deferModel(encoderModelPath, ModelType::ShapeEncoder);
+        deferModel(fcModelPath, ModelType::FC);
 
-    // load the models
-    loadModel(encoderModelPath.toStdString(), ModelType::ShapeEncoder);
-    loadModel(fcModelPath.toStdString(), ModelType::FC);
+        // no lane job has been posted yet
+        mRemoteEncoder = std::make_unique<RemoteInferenceChannel>(
+            RemoteProtocol::ModelKind::Encoder
+        );
+        mRemoteEncoder->setModel(mEncoderLanePath);
+        mRemoteEncoderConnected = mRemoteEncoder->isConnected();
+        mRemoteFC = std::make_unique<RemoteInferenceChannel>(
+            RemoteProtocol::ModelKind::FC
+        );
+        mRemoteFC->setModel(mFCLanePath);
+        mRemoteFCConnected = mRemoteFC->isConnected();
+    }
+    else
+    {
+        loadModel(encoderModelPath.toStdString(), ModelType::ShapeEncoder);
+        loadModel(fcModelPath.toStdString(), ModelType::FC);
+    }
+    mEncoderModelPath = encoderModelPath;
+    mFCModelPath = fcModelPath;
+    mModelDirectory = juce::File(encoderModelPath).getParentDirectory();
+    mFCEncoderHash = mEncoderHash;
+    mFCEncoderHashed = mEncoderHashed;
 
     // do the first prediction to initialize the coefficients
     // and to avoid a delay when the first shape is received
     valueTreeRedirected(mVts.state);
 
+    // the audio thread compares against NaN first, so its first poll
+    // queues every parameter
+    for (int i = 0; i < kNumParameters; i++)
+    {
+        mRawParameters[i] = mVts.getRawParameterValue(getParameterID(i));
+        jassert(mRawParameters[i] != nullptr);
+        mPolledValues[i] = std::numeric_limits<float>::quiet_NaN();
+    }
+    mAutomationEvents.reserve(kAutomationQueueSize + kNumParameters);
+    mAutomationWakeup->add(this);
+
     // add the listener for future changes
     mVts.state.addListener(this);
 
@@ -39,7 +117,74 @@ TorchWrapper::TorchWrapper(
 
 TorchWrapper::~TorchWrapper()
 {
-    mQueueThread.stopThread(100);
+    cancelPendingUpdate();
+
+    // no automation drain is posted anymore
+    mAudioThreadPolling = false;
+    mAutomationWakeup->remove(this);
+
+    // every strand posts into the next lane, so they stop in that order
+    mLoaderStrand.stop();
+    mEncoderStrand.stop();
+    mFCStrand.stop();
+    mCacheStrand.stop();
+
+    // a batched prediction calls back from the batcher strand. Only the
+    // fc lane submits, so after it stopped nothing is submitted anymore
+    mBatcher->cancel(this);
+}
+
+TorchWrapper::AutomationWakeup::AutomationWakeup()
+    : juce::Thread("automation_wakeup")
+{
+    startThread();
+}
+
+TorchWrapper::AutomationWakeup::~AutomationWakeup()
+{
+    signalThreadShouldExit();
+    mEvent.signal();
+    stopThread(1000);
+}
+
+void TorchWrapper::AutomationWakeup::add(TorchWrapper *wrapper)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    mWrappers.push_back(wrapper);
+}
+
+void TorchWrapper::AutomationWakeup::remove(TorchWrapper *wrapper)
+{
+    std::lock_guard<std::mutex> lock(mLock);
+    mWrappers.erase(
+        std::remove(mWrappers.begin(), mWrappers.end(), wrapper),
+        mWrappers.end()
+    );
+}
+
+void TorchWrapper::AutomationWakeup::notify()
+{
+    mEvent.signal();
+}
+
+void TorchWrapper::AutomationWakeup::run()
+{
+    while (!threadShouldExit())
+    {
+        mEvent.wait(-1);
+
+        // the flag is cleared before the drain runs, so a change queued
+        // meanwhile wakes the thread again
+        std::lock_guard<std::mutex> lock(mLock);
+        for (auto *wrapper : mWrappers)
+        {
+            if (!wrapper->mAutomationWake.exchange(false)) { continue; }
+            wrapper->postJob(
+                InferenceTelemetry::Lane::FC,
+                [wrapper] { wrapper->drainAutomation(); }
+            );
+        }
+    }
 }
 
 TorchWrapperIf *TorchWrapper::getTorchWrapperIfPtr()
@@ -47,105 +192,1725 @@ TorchWrapperIf *TorchWrapper::getTorchWrapperIfPtr()
     return this;
 }
 
-void TorchWrapper::loadModel(
-    const std::string &modelPath,
-    const ModelType modelType,
-    const std::string &deviceString
+void TorchWrapper::loadModel(
+    const std::string &modelPath,
+    const ModelType modelType,
+    const std::string &deviceString
+)
+{
+    //! We need to read the models on the contructor
+    //! because the state will be updated immediately
+    //! after the constructor is called (usually)
+    //! doing it in a thread does not guarantee that
+    //! the models will be loaded before the state
+
+    auto device = torch::Device(deviceString);
+    try
+    {
+        // Deserialize the ScriptModule from a file using
+        auto modelFile =
+            juce::File::getCurrentWorkingDirectory().getChildFile(modelPath);
+        uint64_t hash = 0;
+        bool hashed = InferenceCache::hashFile(modelFile, hash);
+        if (modelType == ModelType::ShapeEncoder)
+        {
+            auto encoder = torch::jit::load(modelPath, device);
+            encoder.eval();
+            installEncoder(
+                encoder,
+                hash,
+                hashed,
+                modelFile.getFullPathName()
+            );
+        }
+        else if (modelType == ModelType::FC)
+        {
+            auto fc = torch::jit::load(modelPath, device);
+            fc.eval();
+            installFC(fc, hash, hashed, modelFile.getFullPathName());
+            publishNativePrefix();
+            invalidateLinearization();
+        }
+        else { JLOG("Model type not recognized"); }
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG(
+            "Error loading model: " + modelPath + " " + std::string(e.what())
+        );
+        jassertfalse;
+        return;
+    }
+    JLOG("Model: " + modelPath + " loaded successfully!");
+}
+
+void TorchWrapper::loadModels(
+    const juce::String &encoderModelPath,
+    const juce::String &fcModelPath
+)
+{
+    // the paths may come from the ui or a session, neither of which gets
+    // to pick an arbitrary file to deserialize
+    auto encoderFile = resolveModelPath(encoderModelPath, true);
+    auto fcFile = resolveModelPath(fcModelPath, false);
+    if ((encoderModelPath.isNotEmpty() && encoderFile.isEmpty()) ||
+        (fcModelPath.isNotEmpty() && fcFile.isEmpty()))
+    {
+        JLOG(
+            "Model rejected: " + encoderModelPath + " " + fcModelPath +
+            " is neither a registered tier nor a bundled model"
+        );
+        reportModelLoad(encoderModelPath, fcModelPath, false);
+        return;
+    }
+
+    mLoaderStrand.post(
+        [this, encoderModelPath = encoderFile, fcModelPath = fcFile]
+        {
+            auto swap = std::make_shared<ModelSwap>();
+
+            // the inference host loads the models of a connected lane
+            // itself, the lane only loads one in process to fall back
+            swap->deferEncoder = mRemoteEncoderConnected;
+            swap->deferFC = mRemoteFCConnected;
+            auto exists = [](const juce::String &path)
+            {
+                return juce::File::getCurrentWorkingDirectory()
+                    .getChildFile(path)
+                    .existsAsFile();
+            };
+
+            if (encoderModelPath.isNotEmpty() && swap->deferEncoder)
+            {
+                swap->hasEncoder = exists(encoderModelPath);
+                swap->encoderPath = encoderModelPath;
+                if (!swap->hasEncoder)
+                {
+                    reportModelLoad(encoderModelPath, fcModelPath, false);
+                    return;
+                }
+            }
+            else if (encoderModelPath.isNotEmpty())
+            {
+                swap->hasEncoder = loadValidatedModel(
+                    encoderModelPath,
+                    ModelType::ShapeEncoder,
+                    swap->encoder,
+                    swap->encoderHash,
+                    swap->encoderHashed
+                );
+                swap->encoderPath = encoderModelPath;
+                if (!swap->hasEncoder)
+                {
+                    reportModelLoad(encoderModelPath, fcModelPath, false);
+                    return;
+                }
+            }
+            if (fcModelPath.isNotEmpty() && swap->deferFC)
+            {
+                swap->hasFC = exists(fcModelPath);
+                swap->fcPath = fcModelPath;
+                if (!swap->hasFC)
+                {
+                    reportModelLoad(encoderModelPath, fcModelPath, false);
+                    return;
+                }
+            }
+            else if (fcModelPath.isNotEmpty())
+            {
+                swap->hasFC = loadValidatedModel(
+                    fcModelPath,
+                    ModelType::FC,
+                    swap->fc,
+                    swap->fcHash,
+                    swap->fcHashed
+                );
+                swap->fcPath = fcModelPath;
+                if (!swap->hasFC)
+                {
+                    reportModelLoad(encoderModelPath, fcModelPath, false);
+                    return;
+                }
+            }
+            if (!swap->hasEncoder && !swap->hasFC) { return; }
+
+            postJob(
+                InferenceTelemetry::Lane::Encoder,
+                [this, swap] { swapEncoder(swap); }
+            );
+        }
+    );
+}
+
+bool TorchWrapper::loadValidatedModel(
+    const juce::String &modelPath,
+    const ModelType modelType,
+    torch::jit::Module &module,
+    uint64_t &hash,
+    bool &hashed
+)
+{
+    auto modelFile =
+        juce::File::getCurrentWorkingDirectory().getChildFile(modelPath);
+    try
+    {
+        module = torch::jit::load(modelFile.getFullPathName().toStdString());
+        module.eval();
+
+        // the output has to fit the fc input, or the filterbank
+        c10::InferenceMode guard;
+        std::vector<torch::jit::IValue> inputs;
+        int64_t expectedSize = kNumCoefficients;
+        if (modelType == ModelType::ShapeEncoder)
+        {
+            inputs.emplace_back(
+                torch::rand({1, 1, kImageSize, kImageSize})
+                    .expand({1, kNumImageChannels, kImageSize, kImageSize})
+            );
+            expectedSize = kNumFeatures;
+        }
+        else
+        {
+            inputs.emplace_back(
+                torch::rand({1, kNumFeatures + kNumPositions + kNumMaterials})
+            );
+        }
+
+        auto output = module.forward(inputs).toTensor();
+        if (output.numel() != expectedSize ||
+            !torch::isfinite(output).all().item<bool>())
+        {
+            JLOG(
+                "Model rejected, " + std::to_string(output.numel()) +
+                " outputs instead of " + std::to_string(expectedSize) +
+                " finite ones: " + modelPath.toStdString()
+            );
+            return false;
+        }
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG(
+            "Error loading model: " + modelPath.toStdString() + " " +
+            std::string(e.what())
+        );
+        return false;
+    }
+
+    hashed = InferenceCache::hashFile(modelFile, hash);
+    JLOG("Model: " + modelPath.toStdString() + " loaded and validated");
+    return true;
+}
+
+void TorchWrapper::deferModel(
+    const juce::String &modelPath,
+    const ModelType modelType
+)
+{
+    // hashed like a loaded model, so the cache entries stay valid
+    auto modelFile =
+        juce::File::getCurrentWorkingDirectory().getChildFile(modelPath);
+    uint64_t hash = 0;
+    bool hashed = InferenceCache::hashFile(modelFile, hash);
+    if (modelType == ModelType::ShapeEncoder)
+    {
+        mEncoderHash = hash;
+        mEncoderHashed = hashed;
+        mEncoderLanePath = modelFile.getFullPathName();
+        mEncoderLoaded = false;
+        if (mRemoteEncoder) { mRemoteEncoder->setModel(mEncoderLanePath); }
+
+        // the recent shapes hold features of the previous encoder
+        mRecentShapes.clear();
+        mNextRecentShape = 0;
+    }
+    else
+    {
+        mFCHash = hash;
+        mFCHashed = hashed;
+        mFCLanePath = modelFile.getFullPathName();
+        mFCLoaded = false;
+        if (mRemoteFC) { mRemoteFC->setModel(mFCLanePath); }
+
+        // both belong to the previous network
+        mFCSplitAvailable = false;
+        mNativeFC.reset();
+    }
+    JLOG("Model: " + modelPath.toStdString() + " deferred to the host");
+}
+
+bool TorchWrapper::ensureEncoderLoaded()
+{
+    if (!mEncoderLoaded)
+    {
+        loadModel(mEncoderLanePath.toStdString(), ModelType::ShapeEncoder);
+    }
+    return mEncoderLoaded;
+}
+
+bool TorchWrapper::ensureFCLoaded()
+{
+    if (!mFCLoaded)
+    {
+        loadModel(mFCLanePath.toStdString(), ModelType::FC);
+    }
+    return mFCLoaded;
+}
+
+void TorchWrapper::installEncoder(
+    const torch::jit::Module &encoder,
+    uint64_t hash,
+    bool hashed,
+    const juce::String &path
+)
+{
+    mShapeEncoderNetwork = encoder;
+    mEncoderLoaded = true;
+    foldEncoderInput();
+    mEncoderHash = hash;
+    mEncoderHashed = hashed;
+    mEncoderLanePath = path;
+    if (mRemoteEncoder) { mRemoteEncoder->setModel(path); }
+
+    // the recent shapes hold features of the previous encoder
+    mRecentShapes.clear();
+    mNextRecentShape = 0;
+}
+
+void TorchWrapper::installFC(
+    const torch::jit::Module &fc,
+    uint64_t hash,
+    bool hashed,
+    const juce::String &path
+)
+{
+    mFCNetwork = fc;
+    mFCLoaded = true;
+    mFCHash = hash;
+    mFCHashed = hashed;
+    mFCLanePath = path;
+    if (mRemoteFC) { mRemoteFC->setModel(path); }
+    splitFCNetwork();
+
+    // the host stays in charge while it serves the lane, the network is
+    // only loaded to fall back for a call
+    if (mRemoteFC) { mNativeFC.reset(); }
+    else { buildNativeFC(); }
+}
+
+void TorchWrapper::swapEncoder(std::shared_ptr<ModelSwap> swap)
+{
+    if (swap->hasEncoder)
+    {
+        if (swap->deferEncoder)
+        {
+            deferModel(swap->encoderPath, ModelType::ShapeEncoder);
+            swap->encoderHash = mEncoderHash;
+            swap->encoderHashed = mEncoderHashed;
+        }
+        else
+        {
+            installEncoder(
+                swap->encoder,
+                swap->encoderHash,
+                swap->encoderHashed,
+                swap->encoderPath
+            );
+        }
+
+        // re-encode the latest shape and the morph targets, jobs queued
+        // behind this one already use the new encoder
+        swap->generation = mEncodedGeneration;
+        swap->vertices = mEncodedVertices;
+        if (!swap->vertices.empty())
+        {
+            swap->features.resize(kNumFeatures);
+            if (!encodeFeatures(swap->vertices, swap->features))
+            {
+                swap->features.clear();
+            }
+        }
+        for (const auto &vertices : mMorphTargetVertices)
+        {
+            swap->morphTargets.emplace_back(kNumFeatures);
+            if (!encodeFeatures(vertices, swap->morphTargets.back()))
+            {
+                swap->morphTargets.pop_back();
+            }
+        }
+    }
+
+    postJob(InferenceTelemetry::Lane::FC, [this, swap] { swapFC(swap); });
+}
+
+void TorchWrapper::swapFC(std::shared_ptr<ModelSwap> swap)
+{
+    if (swap->hasFC && swap->deferFC)
+    {
+        deferModel(swap->fcPath, ModelType::FC);
+    }
+    else if (swap->hasFC)
+    {
+        installFC(swap->fc, swap->fcHash, swap->fcHashed, swap->fcPath);
+    }
+
+    if (swap->hasEncoder)
+    {
+        mFCEncoderHash = swap->encoderHash;
+        mFCEncoderHashed = swap->encoderHashed;
+        mMorphTargets = std::move(swap->morphTargets);
+
+        // features of the previous encoder that are still queued are
+        // dropped as older generations
+        if (!swap->features.empty() &&
+            swap->generation >= mAppliedShapeGeneration)
+        {
+            mAppliedShapeGeneration = swap->generation;
+            mShapeVertices = swap->vertices;
+            mShapeFeatures = std::move(swap->features);
+            mShapeFeaturesReady = true;
+            mShapeApproximate = false;
+        }
+    }
+
+    // predict with the new pair, the coefficients reach the audio thread
+    // like any other prediction
+    if (mShapeFeaturesReady) { updateFeatures(); }
+    else { invalidateLinearization(); }
+    JLOG("Models swapped");
+    reportModelLoad(swap->encoderPath, swap->fcPath, true);
+}
+
+juce::String TorchWrapper::resolveModelPath(
+    const juce::String &nameOrPath,
+    bool encoder
+) const
+{
+    if (nameOrPath.isEmpty()) { return {}; }
+
+    juce::SharedResourcePointer<ModelRegistry> registry;
+    for (const auto &tier : registry->getTiers())
+    {
+        auto file = encoder ? tier.encoder : tier.fc;
+        if (tier.name == nameOrPath ||
+            file.getFullPathName() == nameOrPath)
+        {
+            return file.getFullPathName();
+        }
+    }
+
+    // relative paths are relative to the bundled models, ".." would lead
+    // out of their directory without the path showing it
+    auto components = juce::StringArray::fromTokens(nameOrPath, "/\\", "");
+    if (components.contains("..")) { return {}; }
+    auto file = mModelDirectory.getChildFile(nameOrPath);
+    if (!file.isAChildOf(mModelDirectory)) { return {}; }
+    return file.getFullPathName();
+}
+
+void TorchWrapper::reportModelLoad(
+    const juce::String &encoderPath,
+    const juce::String &fcPath,
+    bool accepted
+)
+{
+    {
+        std::lock_guard<std::mutex> lock(mModelLoadResultsLock);
+        mModelLoadResults.push_back({encoderPath, fcPath, accepted});
+    }
+    triggerAsyncUpdate();
+}
+
+void TorchWrapper::handleAsyncUpdate()
+{
+    std::vector<ModelLoadResult> results;
+    {
+        std::lock_guard<std::mutex> lock(mModelLoadResultsLock);
+        results.swap(mModelLoadResults);
+    }
+
+    auto modelTree = mVts.state.getChildWithName("model");
+    for (const auto &result : results)
+    {
+        if (result.encoderPath == mPendingEncoderPath)
+        {
+            mPendingEncoderPath = {};
+        }
+        if (result.fcPath == mPendingFCPath) { mPendingFCPath = {}; }
+
+        if (result.accepted)
+        {
+            if (result.encoderPath.isNotEmpty())
+            {
+                mEncoderModelPath = result.encoderPath;
+            }
+            if (result.fcPath.isNotEmpty()) { mFCModelPath = result.fcPath; }
+            continue;
+        }
+
+        // the previous pair keeps running, so the session keeps naming it.
+        // The reverted property is equal to the model in use, it does not
+        // load anything
+        if (!modelTree.isValid()) { continue; }
+        auto treeEncoder = modelTree.getProperty("encoder").toString();
+        auto treeFC = modelTree.getProperty("fc").toString();
+        if (result.encoderPath.isNotEmpty() &&
+            resolveModelPath(treeEncoder, true) == result.encoderPath)
+        {
+            modelTree.setProperty("encoder", mEncoderModelPath, nullptr);
+        }
+        if (result.fcPath.isNotEmpty() &&
+            resolveModelPath(treeFC, false) == result.fcPath)
+        {
+            modelTree.setProperty("fc", mFCModelPath, nullptr);
+        }
+    }
+    if (!modelTree.isValid()) { return; }
+
+    // a model the ui or a session may not load is reverted right away, the
+    // reverted property loads nothing
+    auto treeEncoder = modelTree.getProperty("encoder").toString();
+    auto treeFC = modelTree.getProperty("fc").toString();
+    auto encoderModelPath = resolveModelPath(treeEncoder, true);
+    auto fcModelPath = resolveModelPath(treeFC, false);
+    if (treeEncoder.isNotEmpty() && encoderModelPath.isEmpty())
+    {
+        JLOG("Model rejected: " + treeEncoder);
+        modelTree.setProperty("encoder", mEncoderModelPath, nullptr);
+    }
+    if (treeFC.isNotEmpty() && fcModelPath.isEmpty())
+    {
+        JLOG("Model rejected: " + treeFC);
+        modelTree.setProperty("fc", mFCModelPath, nullptr);
+    }
+
+    // only load what differs from the models in use or being loaded
+    if (encoderModelPath == mEncoderModelPath ||
+        encoderModelPath == mPendingEncoderPath)
+    {
+        encoderModelPath = {};
+    }
+    if (fcModelPath == mFCModelPath || fcModelPath == mPendingFCPath)
+    {
+        fcModelPath = {};
+    }
+
+    if (encoderModelPath.isNotEmpty() || fcModelPath.isNotEmpty())
+    {
+        if (encoderModelPath.isNotEmpty())
+        {
+            mPendingEncoderPath = encoderModelPath;
+        }
+        if (fcModelPath.isNotEmpty()) { mPendingFCPath = fcModelPath; }
+        loadModels(encoderModelPath, fcModelPath);
+    }
+}
+
+void TorchWrapper::foldEncoderInput()
+{
+    // start from the expanded 3 channel input
+    mEncoderInputs.clear();
+    mEncoderInputs.push_back(mEncoderInputTensor);
+
+    // the image is grayscale, so instead of feeding 3 identical channels
+    // we fold them into the first convolution and feed a single channel.
+    // The folded model is only used if it reproduces the original features.
+    auto folded = mShapeEncoderNetwork.deepcopy();
+    if (!ModelTransforms::foldRepeatedInputChannels(
+            folded,
+            kNumImageChannels
+        ))
+    {
+        JLOG("Encoder input not folded, using the expanded input");
+        return;
+    }
+
+    c10::InferenceMode guard;
+    try
+    {
+        auto image = torch::rand({1, 1, kImageSize, kImageSize});
+        std::vector<torch::jit::IValue> expandedInputs{image.expand(
+            {1, kNumImageChannels, kImageSize, kImageSize}
+        )};
+        std::vector<torch::jit::IValue> foldedInputs{image};
+
+        auto reference =
+            mShapeEncoderNetwork.forward(expandedInputs).toTensor();
+        auto features = folded.forward(foldedInputs).toTensor();
+
+        auto difference =
+            ModelTransforms::relativeMaxDifference(reference, features);
+        if (difference > kFoldTolerance)
+        {
+            JLOG(
+                "Folded encoder differs from the original (" +
+                std::to_string(difference) + "), using the expanded input"
+            );
+            return;
+        }
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG("Error verifying the folded encoder: " + std::string(e.what()));
+        return;
+    }
+
+    mShapeEncoderNetwork = folded;
+    mEncoderInputs.clear();
+    mEncoderInputs.push_back(mImageTensor);
+    JLOG("Encoder input folded into a single channel");
+}
+
+void TorchWrapper::splitFCNetwork()
+{
+    mFCSplitAvailable = false;
+
+    // the features only change with the shape, so the feature part of the
+    // first layer can be computed once per shape and folded into its bias.
+    // The split model is only used if it reproduces the original output.
+    auto split = mFCNetwork.deepcopy();
+    if (!ModelTransforms::splitFirstLinear(
+            split,
+            kNumFeatures + kNumPositions + kNumMaterials,
+            kNumFeatures,
+            mFCSplit
+        ))
+    {
+        JLOG("FC network not split, using the full input");
+        return;
+    }
+
+    c10::InferenceMode guard;
+    try
+    {
+        auto input =
+            torch::rand({1, kNumFeatures + kNumPositions + kNumMaterials});
+        std::vector<torch::jit::IValue> fullInputs{input};
+        std::vector<torch::jit::IValue> splitInputs{
+            input.narrow(1, kNumFeatures, kNumPositions + kNumMaterials)};
+
+        ModelTransforms::updateSplitBias(
+            mFCSplit,
+            input.narrow(1, 0, kNumFeatures).select(0, 0)
+        );
+
+        auto reference = mFCNetwork.forward(fullInputs).toTensor();
+        auto coefficients = split.forward(splitInputs).toTensor();
+
+        auto difference =
+            ModelTransforms::relativeMaxDifference(reference, coefficients);
+        if (difference > kSplitTolerance)
+        {
+            JLOG(
+                "Split fc network differs from the original (" +
+                std::to_string(difference) + "), using the full input"
+            );
+            return;
+        }
+
+        // bring the cached part up to date with the current features
+        ModelTransforms::updateSplitBias(mFCSplit, mFeatureVector);
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG(
+            "Error verifying the split fc network: " + std::string(e.what())
+        );
+        return;
+    }
+
+    mFCSplitNetwork = split;
+    mFCSplitAvailable = true;
+    JLOG("FC network split, the features are cached per shape");
+}
+
+void TorchWrapper::setFCSplitEnabled(bool enabled)
+{
+    mFCSplitEnabled = enabled;
+}
+
+void TorchWrapper::buildNativeFC()
+{
+    mNativeFC.reset();
+
+    auto nativeFC = MLPEvaluator::fromModule(mFCNetwork);
+    if (!nativeFC)
+    {
+        JLOG("FC network not supported natively, using libtorch");
+        return;
+    }
+
+    if (nativeFC->getNumInputs() !=
+            kNumFeatures + kNumPositions + kNumMaterials ||
+        nativeFC->getNumOutputs() != kNumCoefficients)
+    {
+        JLOG("Native fc network has unexpected sizes, using libtorch");
+        return;
+    }
+
+    auto workspace = nativeFC->createWorkspace();
+    std::vector<float> prefix(size_t(nativeFC->getPrefixSize()));
+
+    c10::InferenceMode guard;
+    try
+    {
+        auto input =
+            torch::rand({1, kNumFeatures + kNumPositions + kNumMaterials});
+        std::vector<torch::jit::IValue> inputs{input};
+        auto reference = mFCNetwork.forward(inputs).toTensor();
+
+        auto coefficients = torch::empty({kNumCoefficients});
+        nativeFC->computePrefix(
+            input.data_ptr<float>(),
+            kNumFeatures,
+            prefix.data()
+        );
+        nativeFC->forwardWithPrefix(
+            prefix.data(),
+            input.data_ptr<float>() + kNumFeatures,
+            kNumFeatures,
+            coefficients.data_ptr<float>(),
+            workspace
+        );
+
+        auto difference = ModelTransforms::relativeMaxDifference(
+            reference.reshape({-1}),
+            coefficients
+        );
+        if (difference > kNativeTolerance)
+        {
+            JLOG(
+                "Native fc network differs from libtorch (" +
+                std::to_string(difference) + "), using libtorch"
+            );
+            return;
+        }
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG(
+            "Error verifying the native fc network: " + std::string(e.what())
+        );
+        return;
+    }
+
+    // bring the cached part up to date with the current features
+    nativeFC->computePrefix(
+        mFeatureTensor.data_ptr<float>(),
+        kNumFeatures,
+        prefix.data()
+    );
+
+    mNativeWorkspace = std::move(workspace);
+    mNativePrefix = std::move(prefix);
+    mNativeFC = std::move(nativeFC);
+    JLOG("FC network evaluated natively");
+}
+
+void TorchWrapper::publishNativePrefix()
+{
+    // the prefix is meaningless until the encoder has seen a shape
+    if (!mFeaturesReady) { return; }
+    mProcessorPtr->fcPrefixChanged(mNativeFC, mNativePrefix);
+}
+
+void TorchWrapper::setNativeFCEnabled(bool enabled)
+{
+    mNativeFCEnabled = enabled;
+}
+
+void TorchWrapper::setAudioThreadInferenceEnabled(bool enabled)
+{
+    mAudioThreadInference = enabled;
+}
+
+void TorchWrapper::setLinearizationEnabled(bool enabled)
+{
+    mLinearizationEnabled = enabled;
+}
+
+void TorchWrapper::requestLinearization()
+{
+    if (!mLinearizationEnabled || mLinearizationPending.exchange(true))
+    {
+        return;
+    }
+
+    // queued behind the pending parameter changes, so the jacobian is
+    // computed at the latest parameters and never delays a prediction
+    postJob(
+        InferenceTelemetry::Lane::FC,
+        [this]
+        {
+            mLinearizationPending = false;
+            computeLinearization();
+        }
+    );
+}
+
+void TorchWrapper::computeLinearization()
+{
+    // needs the fc network in process, not the one of the host
+    if (!mFeaturesReady || !mLinearizationEnabled || !mFCLoaded) { return; }
+
+    // the same network as predictCoefficients
+    bool useSplit = mFCSplitAvailable && mFCSplitEnabled;
+    CoefficientLinearization linearization;
+    try
+    {
+        // autograd is not available in inference mode. Every row of the
+        // batch holds the current parameters, so with the identity as grad
+        // output one backward pass gives one jacobian row per coefficient.
+        torch::AutoGradMode gradMode(true);
+
+        auto parameters = mParameterTensor.detach()
+                              .repeat({kNumCoefficients, 1})
+                              .requires_grad_(true);
+
+        std::vector<torch::jit::IValue> inputs;
+        if (useSplit) { inputs.emplace_back(parameters); }
+        else
+        {
+            auto features = mFeatureTensor.detach().expand(
+                {kNumCoefficients, kNumFeatures}
+            );
+            inputs.emplace_back(torch::cat({features, parameters}, 1));
+        }
+
+        auto &network = useSplit ? mFCSplitNetwork : mFCNetwork;
+        auto output = network.forward(inputs).toTensor();
+        output = output.reshape({kNumCoefficients, -1});
+        if (output.size(1) != kNumCoefficients)
+        {
+            JLOG(
+                "Unexpected number of coefficients: " +
+                std::to_string(output.size(1))
+            );
+            jassertfalse;
+            return;
+        }
+
+        auto gradients = torch::autograd::grad(
+            {output},
+            {parameters},
+            {mLinearizationGradOutputs}
+        );
+        auto jacobian = gradients[0].contiguous();
+        auto coefficients = output[0].detach().contiguous();
+        auto base = parameters[0].detach().contiguous();
+
+        std::copy_n(
+            base.data_ptr<float>(),
+            kNumPositions + kNumMaterials,
+            linearization.parameters.begin()
+        );
+        linearization.coefficients.assign(
+            coefficients.data_ptr<float>(),
+            coefficients.data_ptr<float>() + kNumCoefficients
+        );
+        linearization.jacobian.assign(
+            jacobian.data_ptr<float>(),
+            jacobian.data_ptr<float>() + jacobian.numel()
+        );
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG("Error linearizing the fc network: " + std::string(e.what()));
+        jassertfalse;
+        return;
+    }
+
+    // the error of the previous linearization at the new parameters gives
+    // an estimate of the second order term. It decays slowly, so a single
+    // flat region does not open up the bound for good.
+    if (mHasLinearization)
+    {
+        const auto &previous = mLinearization;
+        constexpr int numParameters = kNumPositions + kNumMaterials;
+
+        float delta[numParameters];
+        float maxDelta = 0.0f;
+        for (int j = 0; j < numParameters; j++)
+        {
+            delta[j] = linearization.parameters[size_t(j)] -
+                       previous.parameters[size_t(j)];
+            maxDelta = std::max(maxDelta, std::abs(delta[j]));
+        }
+
+        linearization.curvature = previous.curvature;
+        if (maxDelta > 1e-4f)
+        {
+            float maxError = 0.0f;
+            for (size_t i = 0; i < size_t(kNumCoefficients); i++)
+            {
+                float predicted = previous.coefficients[i];
+                for (int j = 0; j < numParameters; j++)
+                {
+                    predicted += previous.jacobian[i * numParameters + j] *
+                                 delta[j];
+                }
+                maxError = std::max(
+                    maxError,
+                    std::abs(linearization.coefficients[i] - predicted)
+                );
+            }
+            linearization.curvature = std::max(
+                maxError / (maxDelta * maxDelta),
+                0.5f * previous.curvature
+            );
+        }
+    }
+
+    mLinearization = std::move(linearization);
+    mHasLinearization = true;
+    mProcessorPtr->linearizationChanged(mLinearization);
+}
+
+void TorchWrapper::invalidateLinearization()
+{
+    if (!mHasLinearization) { return; }
+
+    mHasLinearization = false;
+    mProcessorPtr->linearizationChanged(CoefficientLinearization());
+}
+
+void TorchWrapper::handleReceivedNewShape(const std::vector<float> &vertices)
+{
+    auto generation = ++mShapeGeneration;
+    postJob(
+        InferenceTelemetry::Lane::Encoder,
+        [this, generation, vertices]
+        { encodeShape(generation, vertices, false); }
+    );
+}
+
+void TorchWrapper::handleReceivedShapePreview(
+    const std::vector<float> &vertices
+)
+{
+    auto generation = ++mShapeGeneration;
+    postJob(
+        InferenceTelemetry::Lane::Encoder,
+        [this, generation, vertices]
+        { encodeShape(generation, vertices, true); }
+    );
+}
+
+void TorchWrapper::encodeShape(
+    uint64_t generation,
+    const std::vector<float> &vertices,
+    bool preview
+)
+{
+    using Stage = InferenceTelemetry::Stage;
+    using Lane = InferenceTelemetry::Lane;
+    auto &telemetry = mProcessorPtr->getTelemetry();
+
+    // superseded before it started, the newer shape is queued behind it
+    if (generation != mShapeGeneration)
+    {
+        telemetry.jobCancelled(Lane::Encoder);
+        return;
+    }
+
+    auto stageStart = InferenceTelemetry::now();
+    std::vector<float> features(kNumFeatures);
+    computeSignature(vertices);
+
+    // while dragging, a recently encoded shape that looks the same at a
+    // coarse resolution stands in until the drag ends
+    bool approximate = preview && findRecentShape(features);
+    if (approximate)
+    {
+        telemetry.record(Stage::EncoderForward, stageStart);
+    }
+    else
+    {
+        if (!encodeFeatures(vertices, features)) { return; }
+        rememberShape(features);
+    }
+    mEncodedGeneration = generation;
+    mEncodedVertices = vertices;
+
+    // hand the features over to the fc lane
+    postJob(
+        Lane::FC,
+        [this,
+         generation,
+         vertices,
+         approximate,
+         features = std::move(features)]
+        { applyFeatures(generation, features, vertices, approximate); }
+    );
+}
+
+bool TorchWrapper::encodeFeatures(
+    const std::vector<float> &vertices,
+    std::vector<float> &features
+)
+{
+    using Stage = InferenceTelemetry::Stage;
+    auto &telemetry = mProcessorPtr->getTelemetry();
+    auto stageStart = InferenceTelemetry::now();
+
+    // a shape seen before, in this or an earlier session, skips the encoder
+    bool useCache = mCacheEnabled && mEncoderHashed;
+    InferenceCache::Key cacheKey(InferenceCache::Kind::Features);
+    if (useCache)
+    {
+        cacheKey = makeCacheKey(InferenceCache::Kind::Features, vertices);
+    }
+    if (useCache &&
+        mCache->lookup(cacheKey, features.data(), kNumFeatures))
+    {
+        telemetry.record(Stage::EncoderForward, stageStart);
+        return true;
+    }
+
+    // the inference host rasterizes and encodes out of process when it
+    // runs, a call it does not answer falls back to the encoder in process
+    if (mRemoteEncoder)
+    {
+        bool served = mRemoteEncoder->call(
+            vertices.data(),
+            vertices.size(),
+            features.data(),
+            kNumFeatures,
+            kRemoteTimeoutMs
+        );
+        mRemoteEncoderConnected = served || mRemoteEncoder->isConnected();
+        if (served)
+        {
+            telemetry.record(Stage::EncoderForward, stageStart);
+            if (useCache)
+            {
+                storeInCache(cacheKey, features.data(), kNumFeatures);
+            }
+            return true;
+        }
+    }
+
+    if (!ensureEncoderLoaded()) { return false; }
+
+    // rasterize the polygon straight into the image tensor, which is the
+    // encoder input, so there is no separate raster to tensor step
+    stageStart = InferenceTelemetry::now();
+    mRasterizer.rasterize(
+        vertices.data(),
+        vertices.size() / 2,
+        mImageTensor.data_ptr<float>()
+    );
+    telemetry.record(Stage::ShapeToRaster, stageStart);
+    stageStart = InferenceTelemetry::now();
+
+    // inference
+    c10::InferenceMode guard;
+    try
+    {
+        // Execute the model
+        auto featureTensor =
+            mShapeEncoderNetwork.forward(mEncoderInputs).toTensor();
+
+        if (featureTensor.numel() != kNumFeatures)
+        {
+            JLOG(
+                "Unexpected number of features: " +
+                std::to_string(featureTensor.numel())
+            );
+            jassertfalse;
+            return false;
+        }
+
+        std::memcpy(
+            features.data(),
+            featureTensor.contiguous().data_ptr<float>(),
+            kNumFeatures * sizeof(float)
+        );
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG("Error processing image: " + std::string(e.what()));
+        jassertfalse;
+        return false;
+    }
+    telemetry.record(Stage::EncoderForward, stageStart);
+
+    if (useCache)
+    {
+        storeInCache(cacheKey, features.data(), kNumFeatures);
+    }
+    return true;
+}
+
+void TorchWrapper::computeSignature(const std::vector<float> &vertices)
+{
+    constexpr float scale = float(kSignatureSize) / float(kImageSize);
+
+    mSignatureVertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        mSignatureVertices[i] = vertices[i] * scale;
+    }
+
+    mSignatureRasterizer.rasterize(
+        mSignatureVertices.data(),
+        mSignatureVertices.size() / 2,
+        mSignature.data()
+    );
+}
+
+bool TorchWrapper::findRecentShape(std::vector<float> &features) const
+{
+    const RecentShape *nearest = nullptr;
+    float nearestDistance = std::numeric_limits<float>::max();
+
+    for (const auto &shape : mRecentShapes)
+    {
+        float distance = 0.0f;
+        for (size_t i = 0; i < mSignature.size(); i++)
+        {
+            float difference = shape.signature[i] - mSignature[i];
+            distance += difference * difference;
+        }
+        if (distance < nearestDistance)
+        {
+            nearestDistance = distance;
+            nearest = &shape;
+        }
+    }
+
+    // root mean square difference of the pixel coverage
+    if (nearest == nullptr ||
+        std::sqrt(nearestDistance / float(mSignature.size())) >
+            kPreviewTolerance)
+    {
+        return false;
+    }
+
+    features = nearest->features;
+    return true;
+}
+
+void TorchWrapper::rememberShape(const std::vector<float> &features)
+{
+    if (mRecentShapes.size() < kNumRecentShapes)
+    {
+        mRecentShapes.push_back({mSignature, features});
+        return;
+    }
+
+    // replace the oldest
+    mRecentShapes[mNextRecentShape] = {mSignature, features};
+    mNextRecentShape = (mNextRecentShape + 1) % kNumRecentShapes;
+}
+
+void TorchWrapper::applyFeatures(
+    uint64_t generation,
+    const std::vector<float> &features,
+    const std::vector<float> &vertices,
+    bool approximate
+)
+{
+    // never let the features of an older shape replace newer ones
+    if (generation <= mAppliedShapeGeneration)
+    {
+        mProcessorPtr->getTelemetry().jobCancelled(
+            InferenceTelemetry::Lane::FC
+        );
+        return;
+    }
+    mAppliedShapeGeneration = generation;
+    mShapeVertices = vertices;
+    mShapeFeatures = features;
+    mShapeFeaturesReady = true;
+    mShapeApproximate = approximate;
+
+    updateFeatures();
+    JLOG("Predicted shape features");
+}
+
+void TorchWrapper::updateFeatures()
+{
+    if (!mShapeFeaturesReady) { return; }
+
+    auto *features = mFeatureTensor.data_ptr<float>();
+    mixFeatures(mMorphAmount, features);
+
+    c10::InferenceMode guard;
+    try
+    {
+        // cache the feature part of the first fc layer for this shape
+        if (mFCSplitAvailable)
+        {
+            ModelTransforms::updateSplitBias(mFCSplit, mFeatureVector);
+        }
+        if (mNativeFC)
+        {
+            mNativeFC->computePrefix(
+                features,
+                kNumFeatures,
+                mNativePrefix.data()
+            );
+        }
+    }
+    catch (const c10::Error &e)
+    {
+        JLOG("Error caching the shape features: " + std::string(e.what()));
+        jassertfalse;
+        return;
+    }
+
+    if (!mFeaturesReady) { mFeaturesReady = true; }
+
+    publishNativePrefix();
+    invalidateLinearization();
+    predictCoefficients();
+}
+
+bool TorchWrapper::isMorphing() const
+{
+    return !mMorphTargets.empty() && mMorphAmount > 0.0f;
+}
+
+void TorchWrapper::mixFeatures(float morph, float *features) const
+{
+    if (mMorphTargets.empty() || morph <= 0.0f)
+    {
+        std::copy(mShapeFeatures.begin(), mShapeFeatures.end(), features);
+        return;
+    }
+
+    // the endpoints of the morph are the current shape followed by the
+    // targets, the morph amount sweeps through all of them
+    auto numSegments = mMorphTargets.size();
+    float position = juce::jlimit(0.0f, 1.0f, morph) * float(numSegments);
+    auto segment = std::min(size_t(position), numSegments - 1);
+    float fraction = position - float(segment);
+
+    const auto &from =
+        segment == 0 ? mShapeFeatures : mMorphTargets[segment - 1];
+    const auto &to = mMorphTargets[segment];
+    for (size_t i = 0; i < size_t(kNumFeatures); i++)
+    {
+        features[i] = from[i] + fraction * (to[i] - from[i]);
+    }
+}
+
+void TorchWrapper::handleReceivedMorphTargets(const juce::var &slots)
+{
+    std::vector<std::vector<float>> targets;
+    if (auto *array = slots.getArray())
+    {
+        for (const auto &slot : *array)
+        {
+            targets.push_back(flattenedVerticesToPixels(slot));
+        }
+    }
+
+    // the endpoints are encoded once here, a morph only runs the fc network
+    using Lane = InferenceTelemetry::Lane;
+    auto generation = ++mMorphGeneration;
+    postJob(
+        Lane::Encoder,
+        [this, generation, targets]
+        {
+            // superseded by newer slots queued behind this job
+            auto &telemetry = mProcessorPtr->getTelemetry();
+            if (generation != mMorphGeneration)
+            {
+                telemetry.jobCancelled(Lane::Encoder);
+                return;
+            }
+
+            // a slot that fails to encode is left out, like on an encoder
+            // swap, the others still morph
+            mMorphTargetVertices.clear();
+            std::vector<std::vector<float>> features;
+            for (const auto &vertices : targets)
+            {
+                features.emplace_back(kNumFeatures);
+                if (encodeFeatures(vertices, features.back()))
+                {
+                    mMorphTargetVertices.push_back(vertices);
+                }
+                else
+                {
+                    JLOG("Morph target left out, it failed to encode");
+                    features.pop_back();
+                }
+            }
+
+            postJob(
+                Lane::FC,
+                [this, generation, features = std::move(features)]() mutable
+                {
+                    if (generation != mMorphGeneration)
+                    {
+                        mProcessorPtr->getTelemetry().jobCancelled(Lane::FC);
+                        return;
+                    }
+                    mMorphTargets = std::move(features);
+                    JLOG(
+                        "Morph targets: " +
+                        std::to_string(mMorphTargets.size())
+                    );
+                    updateFeatures();
+                }
+            );
+        }
+    );
+}
+
+void TorchWrapper::postJob(
+    InferenceTelemetry::Lane lane,
+    std::function<void()> job
+)
+{
+    auto priority = lane == InferenceTelemetry::Lane::Encoder
+                        ? TaskPriority::Encoder
+                        : TaskPriority::Interactive;
+    postJob(lane, priority, std::move(job));
+}
+
+void TorchWrapper::postJob(
+    InferenceTelemetry::Lane lane,
+    TaskPriority priority,
+    std::function<void()> job
+)
+{
+    auto &telemetry = mProcessorPtr->getTelemetry();
+    auto &strand =
+        lane == InferenceTelemetry::Lane::Encoder ? mEncoderStrand
+                                                  : mFCStrand;
+
+    telemetry.jobQueued(lane);
+    strand.post(
+        priority,
+        [&telemetry, lane, job = std::move(job)]
+        {
+            telemetry.jobStarted(lane);
+            job();
+        }
+    );
+}
+
+void TorchWrapper::storeInCache(
+    const InferenceCache::Key &key,
+    const float *values,
+    size_t numValues
+)
+{
+    // the write touches the disk, the lanes go on with the next request
+    mCacheStrand.post(
+        [this, key, entry = std::vector<float>(values, values + numValues)]
+        { mCache->store(key, entry.data(), entry.size()); }
+    );
+}
+
+InferenceCache::Key TorchWrapper::makeCacheKey(
+    InferenceCache::Kind kind,
+    const std::vector<float> &vertices,
+    const float *parameters
+)
+{
+    // the features only depend on the encoder and the shape, the
+    // coefficients also on the fc network and the parameters
+    // features are keyed on the encoder lane, coefficients on the fc lane
+    // by the encoder of the features they were predicted from
+    InferenceCache::Key key(kind);
+    key.append(
+        kind == InferenceCache::Kind::Coefficients ? mFCEncoderHash
+                                                   : mEncoderHash
+    );
+    key.appendQuantized(vertices.data(), vertices.size(), kCacheVertexStep);
+    if (kind == InferenceCache::Kind::Coefficients)
+    {
+        key.append(mFCHash);
+        key.appendQuantized(
+            parameters ? parameters : mParameterTensor.data_ptr<float>(),
+            kNumPositions + kNumMaterials,
+            kCacheParameterStep
+        );
+    }
+    return key;
+}
+
+bool TorchWrapper::canCacheCoefficients() const
+{
+    return mFCHashed && mFCEncoderHashed && !mShapeApproximate;
+}
+
+void TorchWrapper::setCacheEnabled(bool enabled)
+{
+    mCacheEnabled = enabled;
+}
+
+void TorchWrapper::setRemoteInferenceEnabled(bool enabled)
+{
+    // every lane owns its channel
+    postJob(
+        InferenceTelemetry::Lane::Encoder,
+        [this, enabled]
+        {
+            mRemoteEncoder.reset();
+            mRemoteEncoderConnected = false;
+            if (!enabled)
+            {
+                ensureEncoderLoaded();
+                return;
+            }
+            mRemoteEncoder = std::make_unique<RemoteInferenceChannel>(
+                RemoteProtocol::ModelKind::Encoder
+            );
+            mRemoteEncoder->setModel(mEncoderLanePath);
+            mRemoteEncoderConnected = mRemoteEncoder->isConnected();
+        }
+    );
+    postJob(
+        InferenceTelemetry::Lane::FC,
+        [this, enabled]
+        {
+            mRemoteFC.reset();
+            mRemoteFCConnected = false;
+            if (!enabled)
+            {
+                // the network may only have been loaded to fall back
+                if (ensureFCLoaded() && !mNativeFC)
+                {
+                    buildNativeFC();
+                    publishNativePrefix();
+                }
+                return;
+            }
+            mRemoteFC = std::make_unique<RemoteInferenceChannel>(
+                RemoteProtocol::ModelKind::FC
+            );
+            mRemoteFC->setModel(mFCLanePath);
+            mRemoteFCConnected = mRemoteFC->isConnected();
+
+            // the host serves the lane, not the native evaluator
+            mNativeFC.reset();
+            publishNativePrefix();
+        }
+    );
+}
+
+void TorchWrapper::setRemoteInferenceDefault(bool enabled)
+{
+    remoteInferenceDefault() = enabled;
+}
+
+bool TorchWrapper::getRemoteInferenceDefault()
+{
+    return remoteInferenceDefault();
+}
+
+void TorchWrapper::setAudioThreadPollingEnabled(bool enabled)
+{
+    mAudioThreadPolling = enabled;
+    if (!enabled)
+    {
+        // the trees ignored the changes the audio thread queued, the next
+        // tree change must not bring back an older value
+        for (int index = 0; index < kNumParameters; index++)
+        {
+            setParameter(
+                mListenerState,
+                index,
+                mRawParameters[index]->load()
+            );
+        }
+        publishState();
+
+        // and the changes still queued are dropped
+        postJob(InferenceTelemetry::Lane::FC, [this] { drainAutomation(); });
+    }
+}
+
+void TorchWrapper::pollParameters(int64_t samplePosition)
+{
+    if (!mAudioThreadPolling) { return; }
+
+    bool changed = false;
+    for (int index = 0; index < kNumParameters; index++)
+    {
+        auto value = mRawParameters[index]->load();
+        if (value == mPolledValues[index]) { continue; }
+
+        // a change that does not fit the fifo waits in the overflow slot
+        mAutomation.push(index, value, samplePosition);
+        mPolledValues[index] = value;
+        changed = true;
+    }
+
+    // signalled once until the wakeup took the flag
+    if (changed && !mAutomationWake.exchange(true))
+    {
+        mAutomationWakeup->notify();
+    }
+}
+
+void TorchWrapper::readParameters(ResonatorState &state) const
+{
+    for (int index = 0; index < kNumParameters; index++)
+    {
+        setParameter(state, index, mRawParameters[index]->load());
+    }
+}
+
+bool TorchWrapper::predictSynchronously(
+    const ResonatorState &state,
+    std::vector<float> &coefficients
+)
+{
+    // shared with the job, so a timeout does not leave it dangling
+    struct Request
+    {
+        ResonatorState state;
+        std::vector<float> coefficients;
+        bool success = false;
+    };
+    auto request = std::make_shared<Request>();
+    request->state = state;
+
+    auto finished = runAfterQueuedShapes(
+        [this, request]
+        {
+            request->coefficients.resize(kNumCoefficients);
+            request->success = predictBatch(
+                {request->state},
+                request->coefficients.data()
+            );
+        }
+    );
+    if (!finished || !request->success) { return false; }
+
+    std::copy(
+        request->coefficients.begin(),
+        request->coefficients.end(),
+        coefficients.begin()
+    );
+    return true;
+}
+
+bool TorchWrapper::predictBatchSynchronously(
+    const std::vector<ResonatorState> &states,
+    std::vector<float> &coefficients
+)
+{
+    struct Request
+    {
+        std::vector<ResonatorState> states;
+        std::vector<float> coefficients;
+        bool success = false;
+    };
+    auto request = std::make_shared<Request>();
+    request->states = states;
+    request->coefficients.resize(states.size() * kNumCoefficients);
+
+    auto finished = runAfterQueuedShapes(
+        [this, request]
+        {
+            request->success =
+                predictBatch(request->states, request->coefficients.data());
+        }
+    );
+    if (!finished || !request->success) { return false; }
+
+    std::copy(
+        request->coefficients.begin(),
+        request->coefficients.end(),
+        coefficients.begin()
+    );
+    return true;
+}
+
+bool TorchWrapper::runAfterQueuedShapes(std::function<void()> job)
+{
+    // the encoder lane posts every shape to the fc lane when it is done,
+    // so passing through it puts the job behind all of them
+    auto done = std::make_shared<juce::WaitableEvent>();
+    auto sharedJob = std::make_shared<std::function<void()>>(std::move(job));
+    postJob(
+        InferenceTelemetry::Lane::Encoder,
+        [this, done, sharedJob]
+        {
+            postJob(
+                InferenceTelemetry::Lane::FC,
+                [done, sharedJob]
+                {
+                    (*sharedJob)();
+                    done->signal();
+                }
+            );
+        }
+    );
+    return done->wait(kSynchronousTimeoutMs);
+}
+
+bool TorchWrapper::predictBatch(
+    const std::vector<ResonatorState> &states,
+    float *coefficients
 )
 {
-    //! We need to read the models on the contructor
-    //! because the state will be updated immediately
-    //! after the constructor is called (usually)
-    //! doing it in a thread does not guarantee that
-    //! the models will be loaded before the state
+    if (!mFeaturesReady || states.empty() || !ensureFCLoaded())
+    {
+        return false;
+    }
 
-    auto device = torch::Device(deviceString);
+    using Stage = InferenceTelemetry::Stage;
+    auto &telemetry = mProcessorPtr->getTelemetry();
+    auto stageStart = InferenceTelemetry::now();
+    auto numStates = int64_t(states.size());
+
+    // morphed features depend on the state, the current ones are already
+    // folded into the split network and the native prefix
+    bool morph = !mMorphTargets.empty() && mShapeFeaturesReady;
+    bool useSplit = !morph && mFCSplitAvailable && mFCSplitEnabled;
+
+    // the native evaluator has no batched forward
+    if (mNativeFC && mNativeFCEnabled)
+    {
+        std::vector<float> features;
+        std::vector<float> prefix;
+        if (morph)
+        {
+            features.resize(kNumFeatures);
+            prefix.resize(mNativePrefix.size());
+        }
+        for (size_t i = 0; i < states.size(); i++)
+        {
+            if (morph)
+            {
+                mixFeatures(states[i].morph, features.data());
+                mNativeFC->computePrefix(
+                    features.data(),
+                    kNumFeatures,
+                    prefix.data()
+                );
+            }
+            mNativeFC->forwardWithPrefix(
+                morph ? prefix.data() : mNativePrefix.data(),
+                states[i].position,
+                kNumFeatures,
+                coefficients + i * kNumCoefficients,
+                mNativeWorkspace
+            );
+        }
+        telemetry.record(Stage::FCForward, stageStart);
+        return true;
+    }
+
+    c10::InferenceMode guard;
     try
     {
-        // Deserialize the ScriptModule from a file using
-        if (modelType == ModelType::ShapeEncoder)
+        // every row is the current fc input with the parameters of one
+        // state, in split mode only the parameters
+        const auto &row = useSplit ? mParameterTensor : mFCInputTensor;
+        auto input = row.repeat({numStates, 1});
+        auto stride = input.size(1);
+        auto offset = useSplit ? 0 : kNumFeatures;
+        auto *rows = input.data_ptr<float>();
+        for (int64_t i = 0; i < numStates; i++)
         {
-            mShapeEncoderNetwork = torch::jit::load(modelPath, device);
-            mShapeEncoderNetwork.eval();
+            if (morph)
+            {
+                mixFeatures(states[size_t(i)].morph, rows + i * stride);
+            }
+            std::memcpy(
+                rows + i * stride + offset,
+                states[size_t(i)].position,
+                sizeof(float) * (kNumPositions + kNumMaterials)
+            );
         }
-        else if (modelType == ModelType::FC)
+
+        std::vector<torch::jit::IValue> inputs{input};
+        auto &network = useSplit ? mFCSplitNetwork : mFCNetwork;
+        auto output = network.forward(inputs).toTensor();
+        output = output.reshape({numStates, -1}).contiguous();
+        if (output.size(1) != kNumCoefficients)
         {
-            mFCNetwork = torch::jit::load(modelPath, device);
-            mFCNetwork.eval();
+            JLOG(
+                "Unexpected number of coefficients: " +
+                std::to_string(output.size(1))
+            );
+            jassertfalse;
+            return false;
         }
-        else { JLOG("Model type not recognized"); }
+
+        std::memcpy(
+            coefficients,
+            output.data_ptr<float>(),
+            sizeof(float) * size_t(numStates) * kNumCoefficients
+        );
+        telemetry.record(Stage::FCForward, stageStart);
     }
     catch (const c10::Error &e)
     {
-        JLOG(
-            "Error loading model: " + modelPath + " " + std::string(e.what())
-        );
+        JLOG("Error predicting coefficients: " + std::string(e.what()));
         jassertfalse;
-        return;
+        return false;
     }
-    JLOG("Model: " + modelPath + " loaded successfully!");
+    return true;
 }
 
-void TorchWrapper::handleReceivedNewShape(const juce::Path shape)
+void TorchWrapper::drainAutomation()
 {
-    // convert the path to an image
-    juce::Image image = HelperFunctions::shapeToImage(shape);
-
-    // get the bitmap data and convert to a float tensor
-    juce::Image::BitmapData bitmapData(
-        image,
-        juce::Image::BitmapData::readOnly
+    // taken out first, the audio thread keeps pushing while they are
+    // predicted
+    mAutomationEvents.clear();
+    mAutomation.drain(
+        [this](int index, float value, int64_t samplePosition)
+        { mAutomationEvents.push_back({index, value, samplePosition}); }
     );
 
-    // get the bitmap data and convert to a float tensor
-    std::vector<float> bitmapDataAsFloats;
-    bitmapDataAsFloats.reserve(bitmapData.width * bitmapData.height);
-    for (int y = 0; y < bitmapData.height; y++)
+    // once disabled, the state published by setAudioThreadPollingEnabled
+    // is newer than the queued changes
+    if (!mAudioThreadPolling || mAutomationEvents.empty()) { return; }
+
+    // the changes of a block share its stamp, every block is predicted
+    // with the changes up to it, in the order the audio thread saw them
+    auto state = mAppliedState;
+    for (size_t i = 0; i < mAutomationEvents.size(); i++)
     {
-        for (int x = 0; x < bitmapData.width; x++)
-        {
-            bitmapDataAsFloats.push_back(
-                bitmapData.getPixelPointer(x, y)[0] / 255.0f
-            );
-        }
+        const auto &event = mAutomationEvents[i];
+        setParameter(state, event.index, event.value);
+        bool lastOfBlock =
+            i + 1 == mAutomationEvents.size() ||
+            mAutomationEvents[i + 1].samplePosition != event.samplePosition;
+        if (lastOfBlock) { applyParameters(state); }
     }
+}
 
-    // create the tensor
-    int batchSize = 1;
-    int channels = 1;
-    int height = bitmapData.height;
-    int width = bitmapData.width;
-    auto options = torch::TensorOptions().dtype(torch::kFloat);
-    auto tensor = torch::from_blob(
-        bitmapDataAsFloats.data(),
-        {batchSize, channels, height, width},
-        options
-    );
+void TorchWrapper::setPrefetchEnabled(bool enabled)
+{
+    mPrefetchEnabled = enabled;
+}
 
-    // for images we need to repeat the tensor to match the number of channels
-    tensor = tensor.repeat({1, 3, 1, 1});
+void TorchWrapper::setBatchingEnabled(bool enabled)
+{
+    mBatchingEnabled = enabled;
+    if (!enabled) { mBatcher->cancel(this); }
+}
 
-    // inference
-    c10::InferenceMode guard;
-    try
-    {
-        // Create a vector of inputs.
-        std::vector<torch::jit::IValue> inputs;
-        inputs.push_back(tensor);
+std::vector<float> TorchWrapper::flattenedVerticesToPixels(
+    const juce::var &flattenedVertices
+)
+{
+    auto size = flattenedVertices.size();
 
-        // Execute the model and turn its output into a tensor.
-        mFeatureTensor = mShapeEncoderNetwork.forward(inputs).toTensor();
-    }
-    catch (const c10::Error &e)
+    std::vector<float> pixels(size_t(size));
+    for (int i = 0; i + 1 < size; i += 2)
     {
-        JLOG("Error processing image: " + std::string(e.what()));
-        jassertfalse;
-    }
-
-    if (!mFeaturesReady) { mFeaturesReady = true; }
+        auto x = float(flattenedVertices[i]);
+        auto y = float(flattenedVertices[i + 1]);
 
-    predictCoefficients();
-    JLOG("Predicted shape features");
+        // the positions are in the range [-1, 1], so we need to scale them
+        // to the range [0, res] and flip the y axis
+        pixels[i] = (x + 1.0f) * 0.5f * kImageSize;
+        pixels[i + 1] = kImageSize - ((y + 1.0f) * 0.5f * kImageSize);
+    }
+    return pixels;
 }
 
 void TorchWrapper::predictCoefficients()
@@ -157,53 +1922,195 @@ void TorchWrapper::predictCoefficients()
         return;
     }
 
-    if (!mLastMaterialTensor.numel())
+    // a batched result still on its way is superseded by this prediction
+    auto generation = ++mPredictionGeneration;
+
+    // The audio thread evaluates the published native evaluator itself
+    if (mNativeFC && mAudioThreadInference)
+    {
+        return;
+    }
+
+    using Stage = InferenceTelemetry::Stage;
+    auto &telemetry = mProcessorPtr->getTelemetry();
+    auto stageStart = InferenceTelemetry::now();
+
+    // The native evaluator is allocation-free and skips libtorch entirely
+    if (mNativeFC && mNativeFCEnabled)
     {
-        JLOG("Material tensor not initialized");
+        mNativeFC->forwardWithPrefix(
+            mNativePrefix.data(),
+            mParameterTensor.data_ptr<float>(),
+            kNumFeatures,
+            mCoefficients.data(),
+            mNativeWorkspace
+        );
+        telemetry.record(Stage::FCForward, stageStart);
+        mProcessorPtr->coefficentsChanged(mCoefficients);
+        requestLinearization();
         return;
     }
 
-    if (!mLastPositionTensor.numel())
+    // a libtorch forward costs more than a lookup, the native evaluator
+    // does not, and the key does not cover morphed features
+    bool useCache =
+        mCacheEnabled && canCacheCoefficients() && !isMorphing();
+    InferenceCache::Key cacheKey(InferenceCache::Kind::Coefficients);
+    if (useCache)
+    {
+        cacheKey =
+            makeCacheKey(InferenceCache::Kind::Coefficients, mShapeVertices);
+    }
+    if (useCache &&
+        mCache->lookup(cacheKey, mCoefficients.data(), kNumCoefficients))
     {
-        JLOG("Position tensor not initialized");
+        telemetry.record(Stage::FCForward, stageStart);
+        mProcessorPtr->coefficentsChanged(mCoefficients);
+        requestLinearization();
         return;
     }
 
-    // Before inference, we need to concatenate the feature tensor (1x1000)
-    // with position tensor (1x2), and the material tensor (1x5) along the 1st
-    // dimension.
+    // the inference host evaluates the full fc network out of process when
+    // it runs, a call it does not answer falls back to the network in
+    // process
+    if (mRemoteFC)
+    {
+        bool served = mRemoteFC->call(
+            mFCInputTensor.data_ptr<float>(),
+            kNumFeatures + kNumPositions + kNumMaterials,
+            mCoefficients.data(),
+            kNumCoefficients,
+            kRemoteTimeoutMs
+        );
+        mRemoteFCConnected = served || mRemoteFC->isConnected();
+        if (served)
+        {
+            telemetry.record(Stage::FCForward, stageStart);
+            if (useCache)
+            {
+                storeInCache(
+                    cacheKey,
+                    mCoefficients.data(),
+                    kNumCoefficients
+                );
+            }
+            mProcessorPtr->coefficentsChanged(mCoefficients);
+            requestLinearization();
+            return;
+        }
+    }
 
-    auto tensor = torch::cat(
-        {mFeatureTensor, mLastPositionTensor, mLastMaterialTensor},
-        1
-    );
+    if (!ensureFCLoaded())
+    {
+        JLOG("FC network not loaded, prediction skipped");
+        return;
+    }
+
+    // The feature tensor (1x1000), position tensor (1x2) and material
+    // tensor (1x5) are already laid out contiguously in mFCInputTensor,
+    // so it can be fed directly. In split mode only the position and
+    // material are fed, the feature part of the first layer is cached.
+    bool useSplit = mFCSplitAvailable && mFCSplitEnabled;
+
+    // instances running the same fc network share one batched forward,
+    // the result is handed off from the batcher thread
+    if (mBatchingEnabled)
+    {
+        const auto *input = mFCInputTensor.data_ptr<float>();
+        mBatcher->submit(
+            this,
+            mFCHash,
+            mFCNetwork,
+            std::vector<float>(
+                input,
+                input + kNumFeatures + kNumPositions + kNumMaterials
+            ),
+            [this, generation, cacheKey, useCache, stageStart](
+                const std::vector<float> &coefficients
+            )
+            {
+                if (coefficients.size() != size_t(kNumCoefficients))
+                {
+                    JLOG(
+                        "Unexpected number of coefficients: " +
+                        std::to_string(coefficients.size())
+                    );
+                    jassertfalse;
+                    return;
+                }
+                mProcessorPtr->getTelemetry().record(
+                    InferenceTelemetry::Stage::FCForward,
+                    stageStart
+                );
+                if (useCache)
+                {
+                    storeInCache(
+                        cacheKey,
+                        coefficients.data(),
+                        kNumCoefficients
+                    );
+                }
+
+                // delivered from the fc lane, so a newer prediction (a
+                // cache hit, the native evaluator) is never overwritten
+                postJob(
+                    InferenceTelemetry::Lane::FC,
+                    [this, generation, coefficients]
+                    {
+                        if (generation != mPredictionGeneration)
+                        {
+                            mProcessorPtr->getTelemetry().jobCancelled(
+                                InferenceTelemetry::Lane::FC
+                            );
+                            return;
+                        }
+                        mProcessorPtr->coefficentsChanged(coefficients);
+                        requestLinearization();
+                    }
+                );
+            }
+        );
+        return;
+    }
 
-    // std::cout << tensor.sizes() << std::endl;
-#if 1
     // inference
     c10::InferenceMode guard;
     try
     {
-        // Create a vector of inputs.
-        std::vector<torch::jit::IValue> inputs;
-        inputs.push_back(tensor);
+        // Execute the model and copy its output into the coefficients
+        auto coefficientTensor =
+            useSplit ? mFCSplitNetwork.forward(mFCSplitInputs).toTensor()
+                     : mFCNetwork.forward(mFCInputs).toTensor();
 
-        // Execute the model and turn its output into a tensor.
-        auto coefficientTensor = mFCNetwork.forward(inputs).toTensor();
+        if (coefficientTensor.numel() != kNumCoefficients)
+        {
+            JLOG(
+                "Unexpected number of coefficients: " +
+                std::to_string(coefficientTensor.numel())
+            );
+            jassertfalse;
+            return;
+        }
 
         std::memcpy(
             mCoefficients.data(),
-            coefficientTensor.data_ptr(),
-            coefficientTensor.numel() * sizeof(float)
+            coefficientTensor.contiguous().data_ptr<float>(),
+            kNumCoefficients * sizeof(float)
         );
+        telemetry.record(Stage::FCForward, stageStart);
     }
     catch (const c10::Error &e)
     {
-        JLOG("Error processing image: " + std::string(e.what()));
+        JLOG("Error predicting coefficients: " + std::string(e.what()));
         jassertfalse;
+        return;
+    }
+    if (useCache)
+    {
+        storeInCache(cacheKey, mCoefficients.data(), kNumCoefficients);
     }
     mProcessorPtr->coefficentsChanged(mCoefficients);
-#endif
+    requestLinearization();
 }
 
 void TorchWrapper::setServerThreadIf(ServerThreadIf *serverThreadIf)
@@ -211,122 +2118,71 @@ void TorchWrapper::setServerThreadIf(ServerThreadIf *serverThreadIf)
     if (serverThreadIf != nullptr) { mServerThreadIf = serverThreadIf; }
 }
 
-bool TorchWrapper::startThread()
-{
-    return mQueueThread.startThread();
-}
-
 void TorchWrapper::valueTreePropertyChanged(
     juce::ValueTree &changedTree,
     const juce::Identifier &changedProperty
 )
 {
+    static const juce::Identifier paramType("PARAM");
+    static const juce::Identifier polygonType("polygon");
+    static const juce::Identifier modelType("model");
+    static const juce::Identifier morphType("morph");
+
     // get the type of the tree that changed
-    auto treeType = changedTree.getType().toString();
+    const auto &treeType = changedTree.getType();
 
-    if (treeType == "PARAM")
+    // parameters change the most, under automation for every block, so
+    // they are dispatched without any string comparison
+    if (treeType == paramType)
     {
-        auto parameterID = changedTree.getProperty("id").toString();
+        // the audio thread already queued the change
+        if (mAudioThreadPolling) { return; }
 
-        JLOG("TorchWrapper::Parameter changed: " + parameterID);
-
-        if (auto *newValue = changedTree.getPropertyPointer(changedProperty))
+        auto index = findParameterIndex(changedTree);
+        auto *newValue = changedTree.getPropertyPointer(changedProperty);
+        if (index >= 0 && newValue != nullptr)
         {
-            mQueueThread.getIoService().post(
-                [this, parameterID, newValue]
-                {
-                    if (parameterID == "density")
-                    {
-                        mLastMaterialTensor[0][0] = float(*newValue);
-                    }
-                    else if (parameterID == "stiffness")
-                    {
-                        mLastMaterialTensor[0][1] = float(*newValue);
-                    }
-                    else if (parameterID == "pratio")
-                    {
-                        mLastMaterialTensor[0][2] = float(*newValue);
-                    }
-                    else if (parameterID == "alpha")
-                    {
-                        mLastMaterialTensor[0][3] = float(*newValue);
-                    }
-                    else if (parameterID == "beta")
-                    {
-                        mLastMaterialTensor[0][4] = float(*newValue);
-                    }
-                    // the ui lives in the coordinate space where the origin
-                    // is in the centre of the screen, and the range is
-                    // approximately -1 to 1 in both x and y directions. with
-                    // the y axis pointing up. the neural network lives in the
-                    // coordinate space where the origin is in the TOP LEFT
-                    // corner and the range is 0 to 1 in both x and y
-                    // directions.
-                    // we need to convert the values from the ui to the values
-                    // that the neural network expects.
-                    else if (parameterID == "xpos")
-                    {
-                        mLastPositionTensor[0][0] =
-                            (float(*newValue) + 1.0f) * 0.5f;
-                    }
-                    else if (parameterID == "ypos")
-                    {
-                        // the y axis is flipped, so we need to invert the
-                        // value
-                        mLastPositionTensor[0][1] =
-                            1.0f - ((float(*newValue) + 1.0f) * 0.5f);
-                    }
-
-                    this->predictCoefficients();
-                }
-            );
+            setParameter(mListenerState, index, float(*newValue));
+            publishState();
         }
     }
-    else if (treeType == "polygon")
+    else if (treeType == polygonType)
     {
         JLOG("TorchWrapper::Polygon changed");
 
         if (auto *flattenedVertices =
                 changedTree.getPropertyPointer(changedProperty))
         {
-            mQueueThread.getIoService().post(
-                [this, flattenedVertices]
-                {
-                    auto size = flattenedVertices->size();
-
-                    juce::Path path;
-                    int res = 64;
-
-                    for (int i = 0; i < size; i += 2)
-                    {
-                        auto x = float((*flattenedVertices)[i]);
-                        auto y = float((*flattenedVertices)[i + 1]);
-
-                        // the positions are in the range [-1, 1], so we need
-                        // to scale them to the range [0, res] and flip the y
-                        // axis
-                        x = (x + 1) * 0.5 * res;
-                        y = res - ((y + 1) * 0.5 * res);
-                        if (i == 0) { path.startNewSubPath(x, y); }
-                        else { path.lineTo(x, y); }
-                    }
-
-                    // close the subpath
-                    path.closeSubPath();
-
-                    // JLOG(
-                    //     "TorchWrapper::polygon changed: " + path.toString()
-                    // );
-
-                    // handle the path
-                    this->handleReceivedNewShape(path);
-                }
-            );
+            // previews arrive while a vertex is dragged, the value once it
+            // is released
+            auto vertices = flattenedVerticesToPixels(*flattenedVertices);
+            if (changedProperty == "preview")
+            {
+                handleReceivedShapePreview(vertices);
+            }
+            else { handleReceivedNewShape(vertices); }
+        }
+    }
+    else if (treeType == modelType)
+    {
+        // the encoder and fc paths usually change together, they are read
+        // once both are set
+        triggerAsyncUpdate();
+    }
+    else if (treeType == morphType)
+    {
+        if (changedProperty == "slots")
+        {
+            // a removed property clears the targets
+            auto *slots = changedTree.getPropertyPointer(changedProperty);
+            handleReceivedMorphTargets(slots ? *slots : juce::var());
         }
     }
     else
     {
-        JLOG("TorchWrapper::Unknown tree type changed: " + treeType);
+        JLOG(
+            "TorchWrapper::Unknown tree type changed: " + treeType.toString()
+        );
 
         //         else if (parameterID == "vertices")
         // {
@@ -371,73 +2227,272 @@ void TorchWrapper::valueTreeRedirected(juce::ValueTree &redirectedTree)
         redirectedTree.getType().toString()
     );
 
-    auto treeType = redirectedTree.getType().toString();
-
-    // for each child of the tree, get the id and value and set the tensor
-    // accordingly
+    // the parameters and the shape go through the same path as any other
+    // change, the trees of the old state are no longer observed
+    mParameterTrees.clear();
     for (int i = 0; i < redirectedTree.getNumChildren(); i++)
     {
         auto child = redirectedTree.getChild(i);
         auto parameterID = child.getProperty("id").toString();
 
+        if (child.hasType("morph"))
+        {
+            handleReceivedMorphTargets(child.getProperty("slots"));
+            continue;
+        }
+        if (child.hasType("model"))
+        {
+            triggerAsyncUpdate();
+            continue;
+        }
+
         if (auto *newValue = child.getPropertyPointer("value"))
         {
-            if (parameterID == "density")
-            {
-                mLastMaterialTensor[0][0] = float(*newValue);
-            }
-            else if (parameterID == "stiffness")
-            {
-                mLastMaterialTensor[0][1] = float(*newValue);
-            }
-            else if (parameterID == "pratio")
-            {
-                mLastMaterialTensor[0][2] = float(*newValue);
-            }
-            else if (parameterID == "alpha")
+            if (parameterID == "vertices")
             {
-                mLastMaterialTensor[0][3] = float(*newValue);
+                handleReceivedNewShape(flattenedVerticesToPixels(*newValue));
             }
-            else if (parameterID == "beta")
+            else if (auto index = findParameterIndex(child); index >= 0)
             {
-                mLastMaterialTensor[0][4] = float(*newValue);
+                setParameter(mListenerState, index, float(*newValue));
             }
-            else if (parameterID == "xpos")
+        }
+    }
+    publishState();
+}
+
+int TorchWrapper::getParameterIndex(const juce::String &parameterID)
+{
+    for (int i = 0; i < kNumParameters; i++)
+    {
+        if (parameterID == getParameterID(i)) { return i; }
+    }
+    return -1;
+}
+
+const char *TorchWrapper::getParameterID(int index)
+{
+    static const char *const parameterIDs[kNumParameters] = {
+        "density", "stiffness", "pratio", "alpha",
+        "beta",    "xpos",      "ypos",   "morph"};
+    jassert(index >= 0 && index < kNumParameters);
+    return parameterIDs[index];
+}
+
+int TorchWrapper::findParameterIndex(const juce::ValueTree &parameterTree)
+{
+    // ValueTree equality compares the shared object, so after the first
+    // change of a parameter its id is never looked at again
+    for (const auto &entry : mParameterTrees)
+    {
+        if (entry.first == parameterTree) { return entry.second; }
+    }
+    auto parameterID = parameterTree.getProperty("id").toString();
+    auto index = getParameterIndex(parameterID);
+    mParameterTrees.emplace_back(parameterTree, index);
+    return index;
+}
+
+void TorchWrapper::setParameter(
+    ResonatorState &state,
+    int index,
+    float value
+)
+{
+    if (index == kDensity) { state.material[0] = value; }
+    else if (index == kStiffness) { state.material[1] = value; }
+    else if (index == kPRatio) { state.material[2] = value; }
+    else if (index == kAlpha) { state.material[3] = value; }
+    else if (index == kBeta) { state.material[4] = value; }
+    // the ui lives in the coordinate space where the origin is in the
+    // centre of the screen, and the range is approximately -1 to 1 in both
+    // x and y directions. with the y axis pointing up. the neural network
+    // lives in the coordinate space where the origin is in the TOP LEFT
+    // corner and the range is 0 to 1 in both x and y directions.
+    // we need to convert the values from the ui to the values that the
+    // neural network expects.
+    else if (index == kXPos) { state.position[0] = (value + 1.0f) * 0.5f; }
+    else if (index == kYPos)
+    {
+        // the y axis is flipped, so we need to invert the value
+        state.position[1] = 1.0f - ((value + 1.0f) * 0.5f);
+    }
+    else if (index == kMorph) { state.morph = value; }
+}
+
+void TorchWrapper::publishState()
+{
+    mState.write(mListenerState);
+    if (mStatePending.exchange(true)) { return; }
+
+    postJob(
+        InferenceTelemetry::Lane::FC,
+        [this]
+        {
+            mStatePending = false;
+            applyState();
+        }
+    );
+}
+
+void TorchWrapper::applyState()
+{
+    ResonatorState state;
+    auto version = mState.read(state);
+    if (version == mAppliedStateVersion) { return; }
+    mAppliedStateVersion = version;
+    applyParameters(state);
+}
+
+void TorchWrapper::applyParameters(const ResonatorState &state)
+{
+    // position and material follow each other in both, one copy writes
+    // the parameter part of the fc input
+    static_assert(
+        offsetof(ResonatorState, material) ==
+        offsetof(ResonatorState, position) + sizeof(float) * kNumPositions
+    );
+    std::memcpy(
+        mParameterTensor.data_ptr<float>(),
+        state.position,
+        sizeof(float) * (kNumPositions + kNumMaterials)
+    );
+
+    // a morph changes the features, everything else only the fc input
+    bool morphChanged = state.morph != mAppliedState.morph;
+    auto previous = mAppliedState;
+    mAppliedState = state;
+    mMorphAmount = state.morph;
+    if (morphChanged && !mMorphTargets.empty())
+    {
+        updateFeatures();
+        return;
+    }
+    predictCoefficients();
+    schedulePrefetch(previous, state);
+}
+
+void TorchWrapper::schedulePrefetch(
+    const ResonatorState &previous,
+    const ResonatorState &current
+)
+{
+    ++mPrefetchGeneration;
+    mPrefetchStates.clear();
+    mNextPrefetch = 0;
+    // the key does not cover morphed features, the native evaluator costs
+    // less than a lookup, and a prefetch must not load a model the host
+    // serves
+    if (!mPrefetchEnabled || !mCacheEnabled || !canCacheCoefficients() ||
+        !mFeaturesReady || !mFCLoaded || !mMorphTargets.empty() ||
+        (mNativeFC && mNativeFCEnabled))
+    {
+        return;
+    }
+
+    // a prefetched entry only hits if its key matches the one of a real
+    // request, so the steps are clamped and snapped like the parameters,
+    // in the ui space of the parameters
+    auto snap = [this](int index, float value)
+    {
+        return mVts.getParameterRange(getParameterID(index))
+            .snapToLegalValue(value);
+    };
+
+    float dx = current.position[0] - previous.position[0];
+    float dy = current.position[1] - previous.position[1];
+    if (dx != 0.0f || dy != 0.0f)
+    {
+        // the exciter is dragged, follow its direction until the edge.
+        // The inverse of setParameter, the y axis of the ui points up
+        float x = current.position[0] * 2.0f - 1.0f;
+        float y = 1.0f - current.position[1] * 2.0f;
+        float stepX = dx * 2.0f;
+        float stepY = -dy * 2.0f;
+        auto last = current;
+        for (int step = 1; step <= kNumPrefetchSteps; step++)
+        {
+            auto state = current;
+            setParameter(state, kXPos, snap(kXPos, x + float(step) * stepX));
+            setParameter(state, kYPos, snap(kYPos, y + float(step) * stepY));
+            if (state.position[0] == last.position[0] &&
+                state.position[1] == last.position[1])
             {
-                mLastPositionTensor[0][0] = (float(*newValue) + 1.0f) * 0.5f;
+                break;
             }
-            else if (parameterID == "ypos")
+            mPrefetchStates.push_back(state);
+            last = state;
+        }
+    }
+    else
+    {
+        int touched = -1;
+        for (int i = 0; i < kNumMaterials && touched < 0; i++)
+        {
+            if (current.material[i] != previous.material[i]) { touched = i; }
+        }
+        if (touched < 0) { return; }
+
+        // the material parameters follow kDensity in the same order. The
+        // nearest neighbours come first, a step past the edge of the range
+        // snaps back onto the previous one and is skipped
+        float last[] = {current.material[touched], current.material[touched]};
+        for (int step = 1; step <= kNumPrefetchSteps; step++)
+        {
+            for (int side = 0; side < 2; side++)
             {
-                mLastPositionTensor[0][1] =
-                    1.0f - ((float(*newValue) + 1.0f) * 0.5f);
+                float sign = side == 0 ? 1.0f : -1.0f;
+                auto state = current;
+                state.material[touched] = snap(
+                    kDensity + touched,
+                    current.material[touched] +
+                        sign * float(step) * kParameterStep
+                );
+                if (state.material[touched] == last[side]) { continue; }
+                mPrefetchStates.push_back(state);
+                last[side] = state.material[touched];
             }
-            else if (parameterID == "vertices")
-            {
-                auto size = newValue->size();
-
-                juce::Path path;
-                int res = 64;
+        }
+    }
+    if (!mPrefetchStates.empty()) { postPrefetch(); }
+}
 
-                for (int i = 0; i < size; i += 2)
-                {
-                    auto x = float((*newValue)[i]);
-                    auto y = float((*newValue)[i + 1]);
-
-                    // the positions are in the range [-1, 1], so we need
-                    // to scale them to the range [0, res] and flip the y
-                    // axis
-                    x = (x + 1) * 0.5 * res;
-                    y = res - ((y + 1) * 0.5 * res);
-                    if (i == 0) { path.startNewSubPath(x, y); }
-                    else { path.lineTo(x, y); }
-                }
+void TorchWrapper::postPrefetch()
+{
+    // behind every prediction, and behind the encoder of a new shape
+    postJob(
+        InferenceTelemetry::Lane::FC,
+        TaskPriority::Background,
+        [this, generation = mPrefetchGeneration] { prefetch(generation); }
+    );
+}
 
-                // close the subpath
-                path.closeSubPath();
+void TorchWrapper::prefetch(uint64_t generation)
+{
+    // superseded by a newer change, or a real request is waiting
+    auto &telemetry = mProcessorPtr->getTelemetry();
+    auto lane = InferenceTelemetry::Lane::FC;
+    // or the conditions of schedulePrefetch no longer hold
+    if (generation != mPrefetchGeneration ||
+        telemetry.getLaneSummary(lane).queueDepth > 0 ||
+        mNextPrefetch >= mPrefetchStates.size() || !mFCLoaded ||
+        !mMorphTargets.empty() || (mNativeFC && mNativeFCEnabled))
+    {
+        telemetry.jobCancelled(lane);
+        return;
+    }
 
-                // handle the path
-                this->handleReceivedNewShape(path);
-            }
-        }
+    const auto &state = mPrefetchStates[mNextPrefetch++];
+    auto key = makeCacheKey(
+        InferenceCache::Kind::Coefficients,
+        mShapeVertices,
+        state.position
+    );
+    if (!mCache->lookup(key, mPrefetchCoefficients.data(), kNumCoefficients)
+        && predictBatch({state}, mPrefetchCoefficients.data()))
+    {
+        storeInCache(key, mPrefetchCoefficients.data(), kNumCoefficients);
     }
-}
\ No newline at end of file
+
+    if (mNextPrefetch < mPrefetchStates.size()) { postPrefetch(); }
+}
@@ -1,17 +1,32 @@
 #pragma once
 
-#include "QueueThread.h"
+#include "TaskExecutor.h"
 #include "ProcessorIf.h"
 #include "TorchWrapperIf.h"
 #include "ServerThreadIf.h"
 #include "RemoteParameterAttachment.h"
+#include "PolygonRasterizer.h"
+#include "ModelTransforms.h"
+#include "MLPEvaluator.h"
+#include "InferenceTelemetry.h"
+#include "ControlRateInference.h"
+#include "InferenceCache.h"
+#include "InferenceBatcher.h"
+#include "RemoteInferenceChannel.h"
+#include "ResonatorState.h"
+#include "ParameterEventQueue.h"
 
 #include <juce_gui_basics/juce_gui_basics.h>
 #include <juce_data_structures/juce_data_structures.h>
 #include <torch/script.h>
 #include <torch/torch.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
 
-class TorchWrapper : public TorchWrapperIf, private juce::ValueTree::Listener
+class TorchWrapper : public TorchWrapperIf,
+                     private juce::ValueTree::Listener,
+                     private juce::AsyncUpdater
 {
 public:
     enum class ModelType
@@ -36,15 +51,222 @@ public:
         const std::string& deviceString = "cpu"
     );
 
-    void handleReceivedNewShape(const juce::Path shape);
+    /**
+     * @brief  Replace the encoder and fc network without interrupting the
+     * audio
+     * @note   The models are loaded and validated on a background thread
+     * while the current ones stay in use. A model that fails to load, or
+     * does not produce kNumFeatures (encoder) or kNumCoefficients (fc)
+     * finite outputs, is rejected. The encoder is then swapped on the
+     * encoder lane, where the latest shape and the morph targets are
+     * re-encoded, and the fc network on the fc lane together with the new
+     * features, so no prediction mixes the two pairs. The new coefficients
+     * reach the audio thread like any other prediction. Usually driven by
+     * the "encoder" and "fc" properties of the model tree, which come
+     * from the ui and from saved sessions, so only the name of a
+     * registered ModelRegistry tier, a model file of a registered tier or
+     * a file under the directory of the bundled models is loaded, anything
+     * else is rejected.
+     * @param  encoderModelPath: TorchScript file or tier name, empty keeps
+     * the current
+     * @param  fcModelPath: TorchScript file or tier name, empty keeps the
+     * current
+     */
+    void loadModels(
+        const juce::String& encoderModelPath,
+        const juce::String& fcModelPath
+    );
+
+    /**
+     * @brief  Queue a new polygon on the encoder lane
+     * @note   Inference runs as a pipeline on two lanes: the encoder lane
+     * rasterizes and encodes, the fc lane applies the features, predicts
+     * and publishes. Every shape and parameter change gets a generation,
+     * and a job that was superseded by a newer one of its kind before it
+     * started is cancelled. Parameter changes never wait behind queued
+     * encoder jobs.
+     * @param  vertices: interleaved x, y vertex coordinates in pixel space
+     * @retval None
+     */
+    void handleReceivedNewShape(const std::vector<float>& vertices);
+
+    /**
+     * @brief  Queue an intermediate polygon of a drag on the encoder lane
+     * @note   If a recently encoded shape rasterizes to nearly the same
+     * coarse image, its features are used instead of running the encoder.
+     * The exact shape follows with handleReceivedNewShape when the drag
+     * ends.
+     * @param  vertices: interleaved x, y vertex coordinates in pixel space
+     */
+    void handleReceivedShapePreview(const std::vector<float>& vertices);
+
+    /**
+     * @brief  Encode the morph targets, from the "slots" of the morph tree
+     * @note   The features of the current shape and of every target are
+     * the endpoints of the "morph" parameter, which interpolates between
+     * them in feature space. Moving it only runs the fc network.
+     * @param  slots: array of flattened [-1, 1] polygons
+     */
+    void handleReceivedMorphTargets(const juce::var& slots);
 
     void updateMaterial(const std::vector<float>& material);
     void updatePosition(const std::vector<float>& position);
 
     void predictCoefficients();
 
+    /**
+     * @brief  Enable or disable the split evaluation of the fc network
+     * @note   When enabled (the default) and the model supports it, the
+     * feature part of the first fc layer is computed once per shape, and
+     * parameter changes only evaluate the position and material part.
+     */
+    void setFCSplitEnabled(bool enabled);
+
+    /**
+     * @brief  Enable or disable the native evaluator of the fc network
+     * @note   When enabled (the default) and the fc graph only contains
+     * supported ops, the fc network is evaluated by MLPEvaluator instead of
+     * libtorch. Otherwise libtorch is used.
+     */
+    void setNativeFCEnabled(bool enabled);
+
+    /**
+     * @brief  Tell the wrapper that the audio thread evaluates the fc network
+     * @note   While enabled and the native evaluator is available, parameter
+     * changes do not trigger a prediction here. The evaluator and its prefix
+     * are still published to the processor for every new shape.
+     */
+    void setAudioThreadInferenceEnabled(bool enabled);
+
+    /**
+     * @brief  Follow the parameters from the audio thread instead of the
+     * value tree
+     * @note   The value tree follows the parameters on the message thread,
+     * so automation never reached the models while the message thread was
+     * blocked, for example in headless or offline hosts. While enabled,
+     * pollParameters queues every change it sees in a ParameterEventQueue,
+     * stamped with the sample position of the block, and wakes the fc lane.
+     * The lane predicts the changes of every block in stamp order. The
+     * parameter trees are ignored meanwhile, so the host has to keep
+     * calling processBlock. When disabled, the parameters are taken over
+     * from the raw values again, which the trees ignored meanwhile.
+     */
+    void setAudioThreadPollingEnabled(bool enabled);
+
+    /**
+     * @brief  Queue the parameters that changed since the last call, on the
+     * audio thread
+     * @param  samplePosition: of the start of the block
+     */
+    void pollParameters(int64_t samplePosition);
+
+    /**
+     * @brief  The current parameters, read from the raw values on any
+     * thread
+     */
+    void readParameters(ResonatorState& state) const;
+
+    /**
+     * @brief  Predict the coefficients of a state and wait for them
+     * @note   For offline renders, where the caller may block. The request
+     * passes through the encoder lane first, so every shape queued before
+     * it is applied. The fc network then runs in process, without the
+     * inference host, the batcher or the coefficient cache, so the result
+     * does not depend on other instances or on what was predicted before.
+     * It is free of side effects: the result is only handed to the
+     * caller, the fc input and the applied state of the wrapper stay as
+     * they are, and nothing is published or linearized. A deferred fc
+     * network is loaded in process first.
+     * @param  coefficients: kNumCoefficients floats, only written on success
+     * @retval false if there are no features yet or the lanes do not answer
+     * within kSynchronousTimeoutMs
+     */
+    bool predictSynchronously(
+        const ResonatorState& state,
+        std::vector<float>& coefficients
+    );
+
+    /**
+     * @brief  Predict the coefficients of several states with one batched
+     * fc forward and wait for them
+     * @note   Like predictSynchronously. With the native evaluator the
+     * states are predicted one after the other instead.
+     * @param  coefficients: states.size() * kNumCoefficients floats, state
+     * after state, only written on success
+     */
+    bool predictBatchSynchronously(
+        const std::vector<ResonatorState>& states,
+        std::vector<float>& coefficients
+    );
+
+    /**
+     * @brief  Enable the linearization of the fc network
+     * @note   When enabled, the jacobian of the coefficients with respect to
+     * position and material is computed with autograd after every
+     * prediction, as a separate job on the torch thread, and published to
+     * the processor for extrapolation.
+     */
+    void setLinearizationEnabled(bool enabled);
+
+    /**
+     * @brief  Enable or disable the persistent feature and coefficient cache
+     * @note   When enabled (the default), the features of every shape and
+     * the coefficients predicted by libtorch are stored on disk, keyed by
+     * the model files and the quantized shape and parameters, and looked up
+     * before running the networks.
+     */
+    void setCacheEnabled(bool enabled);
+
+    /**
+     * @brief  Predict the neighbours of the latest change while idle
+     * @note   Disabled by default. When enabled, every prediction after a
+     * parameter change is followed by predictions one and two slider steps
+     * around the material parameter that changed, or one and two steps
+     * further in the direction the position moved. They go into the
+     * coefficient cache, so a slider drag mostly hits it. Every neighbour
+     * is its own fc lane job, it is dropped as soon as any other job waits.
+     * Only the libtorch path uses the cache, so nothing is prefetched for
+     * the native evaluator or while there are morph targets, a prefetch
+     * never publishes coefficients or touches the parameters.
+     */
+    void setPrefetchEnabled(bool enabled);
+
+    /**
+     * @brief  Batch the libtorch fc forwards with other instances
+     * @note   When enabled, a prediction that is not served by the native
+     * evaluator or the cache is submitted to the process wide
+     * InferenceBatcher with the full fc input, and its coefficients are
+     * handed off from the batcher strand. Trades up to the batching window
+     * of latency for throughput when many instances predict at once.
+     */
+    void setBatchingEnabled(bool enabled);
+
+    /**
+     * @brief  Run the models in the out-of-process inference host
+     * @note   When enabled, every lane opens a shared memory channel to the
+     * host (see RemoteProtocol) and sends its encoder or fc requests there
+     * while the host is running. A missing, busy or crashed host costs at
+     * most kRemoteTimeoutMs, then the lane runs that call in process and
+     * asks the host again for the next one. The native fc evaluator is
+     * not used while enabled. The host picks the channels up whenever it
+     * (re)starts. Models loaded through loadModels while the host answers
+     * are named to it without loading them in process.
+     */
+    void setRemoteInferenceEnabled(bool enabled);
+
+    /**
+     * @brief  Enable remote inference in the instances created from now on
+     * @note   Set it before creating the plugin instances. Their models are
+     * then not loaded in process at construction, a lane only loads its
+     * model the first time the host does not answer, so instances served
+     * by the host do not hold a copy of the networks. The derived models
+     * (split fc and the linearization) only exist once the fc network is
+     * loaded.
+     */
+    static void setRemoteInferenceDefault(bool enabled);
+    static bool getRemoteInferenceDefault();
+
     void setServerThreadIf(ServerThreadIf* serverThreadIfPtr);
-    bool startThread();
 
 protected:
     void valueTreePropertyChanged(
@@ -59,14 +281,578 @@ protected:
     void valueTreeParentChanged(juce::ValueTree&) override;
     void valueTreeRedirected(juce::ValueTree&) override;
 
+    /**
+     * @brief  Take over the outcome of finished loads, then load the
+     * models of the model tree, on the message thread
+     */
+    void handleAsyncUpdate() override;
+
+private:
+    /**
+     * @brief  Posts the automation drains of all instances
+     * @note   The audio thread must not allocate or lock, so it cannot post
+     * a job itself. pollParameters flags its instance and signals this
+     * thread, which posts the drain to the fc lane of every flagged one.
+     * Shared through juce::SharedResourcePointer.
+     */
+    class AutomationWakeup : public juce::Thread
+    {
+    public:
+        AutomationWakeup();
+        ~AutomationWakeup() override;
+
+        void add(TorchWrapper* wrapper);
+        /**
+         * @note   No drain of the wrapper is posted after it returns
+         */
+        void remove(TorchWrapper* wrapper);
+
+        /**
+         * @brief  Wake the thread, from the audio thread
+         */
+        void notify();
+
+        void run() override;
+
+    private:
+        std::mutex mLock;
+        std::vector<TorchWrapper*> mWrappers;
+        juce::WaitableEvent mEvent;
+    };
+
+    /**
+     * @brief  Outcome of a loadModels request, see reportModelLoad
+     */
+    struct ModelLoadResult
+    {
+        juce::String encoderPath;
+        juce::String fcPath;
+        bool accepted = false;
+    };
+
+    /**
+     * @brief  The model file a loadModels argument names, see loadModels
+     * @param  nameOrPath: tier name or path
+     * @param  encoder: the encoder of a tier, otherwise its fc network
+     * @retval empty if it is neither a registered tier nor an allowed file
+     */
+    juce::String resolveModelPath(
+        const juce::String& nameOrPath,
+        bool encoder
+    ) const;
+
+    /**
+     * @brief  Hand the outcome of a load to the message thread, an accepted
+     * pair is recorded as in use, a rejected one is reverted in the model
+     * tree
+     */
+    void reportModelLoad(
+        const juce::String& encoderPath,
+        const juce::String& fcPath,
+        bool accepted
+    );
+
+    /**
+     * @brief  Models loaded by loadModels, handed from the loader thread to
+     * the encoder lane and from there to the fc lane
+     */
+    struct ModelSwap
+    {
+        bool hasEncoder = false;
+        torch::jit::Module encoder;
+        uint64_t encoderHash = 0;
+        bool encoderHashed = false;
+        juce::String encoderPath;
+        bool hasFC = false;
+        torch::jit::Module fc;
+        uint64_t fcHash = 0;
+        bool fcHashed = false;
+        juce::String fcPath;
+        // the inference host serves them, not loaded in process
+        bool deferEncoder = false;
+        bool deferFC = false;
+
+        // the latest shape and the morph targets, with the new encoder
+        uint64_t generation = 0;
+        std::vector<float> vertices;
+        std::vector<float> features;
+        std::vector<std::vector<float>> morphTargets;
+    };
+
+    /**
+     * @brief  Load a model and check the size of its output
+     * @retval false if it cannot be used
+     */
+    bool loadValidatedModel(
+        const juce::String& modelPath,
+        const ModelType modelType,
+        torch::jit::Module& module,
+        uint64_t& hash,
+        bool& hashed
+    );
+
+    /**
+     * @brief  Name a model for the inference host without loading it
+     */
+    void deferModel(const juce::String& modelPath, const ModelType modelType);
+
+    /**
+     * @brief  Load a deferred model in process, on its lane
+     * @note   For a call the host did not answer. A failed load is tried
+     * again by the next call, the lane keeps asking the host first.
+     * @retval false if the model could not be loaded
+     */
+    bool ensureEncoderLoaded();
+    bool ensureFCLoaded();
+
+    /**
+     * @brief  Take a model into use, with its derived models
+     */
+    void installEncoder(
+        const torch::jit::Module& encoder,
+        uint64_t hash,
+        bool hashed,
+        const juce::String& path
+    );
+    void installFC(
+        const torch::jit::Module& fc,
+        uint64_t hash,
+        bool hashed,
+        const juce::String& path
+    );
+
+    /**
+     * @brief  The encoder lane and the fc lane half of a model swap
+     */
+    void swapEncoder(std::shared_ptr<ModelSwap> swap);
+    void swapFC(std::shared_ptr<ModelSwap> swap);
+
+    /**
+     * @brief  Fold the repeated grayscale channels into the first
+     * convolution of the encoder
+     * @note   Falls back to the expanded 3 channel input if the model has no
+     * matching convolution or if the folded model does not reproduce the
+     * original features
+     */
+    void foldEncoderInput();
+
+    /**
+     * @brief  Build the split copy of the fc network
+     * @note   Falls back to the full input if the first layer cannot be
+     * split or if the split model does not reproduce the original output
+     */
+    void splitFCNetwork();
+
+    /**
+     * @brief  Extract the native evaluator of the fc network
+     * @note   It is only used if it reproduces the libtorch output
+     */
+    void buildNativeFC();
+
+    /**
+     * @brief  Publish the native evaluator and its prefix to the processor
+     */
+    void publishNativePrefix();
+
+    /**
+     * @brief  Queue a linearization, at most one is pending at a time
+     */
+    void requestLinearization();
+    void computeLinearization();
+
+    /**
+     * @brief  Drop the linearization after a shape or model change
+     */
+    void invalidateLinearization();
+
+    /**
+     * @brief  Whether the coefficients of the current shape can be cached:
+     * the fc network and the encoder of its features could be hashed, a
+     * key of an unreadable model file does not identify it, and the
+     * features are not a stand-in
+     */
+    bool canCacheCoefficients() const;
+
+    /**
+     * @brief  Cache key of a shape, and for coefficients of the current
+     * parameters
+     */
+    InferenceCache::Key makeCacheKey(
+        InferenceCache::Kind kind,
+        const std::vector<float>& vertices,
+        const float* parameters = nullptr
+    );
+
+    /**
+     * @brief  Queue the neighbours of a parameter change for prefetching,
+     * replacing the queued ones, on the fc lane
+     */
+    void schedulePrefetch(
+        const ResonatorState& previous,
+        const ResonatorState& current
+    );
+    void postPrefetch();
+    void prefetch(uint64_t generation);
+
+    /**
+     * @brief  Rasterize and encode a shape, on the encoder lane
+     */
+    void encodeShape(
+        uint64_t generation,
+        const std::vector<float>& vertices,
+        bool preview
+    );
+
+    /**
+     * @brief  Rasterize a shape into the coarse mSignature
+     */
+    void computeSignature(const std::vector<float>& vertices);
+
+    /**
+     * @brief  Features of the recent shape nearest to mSignature
+     * @retval true if it is within kPreviewTolerance
+     */
+    bool findRecentShape(std::vector<float>& features) const;
+
+    /**
+     * @brief  Remember the features of the shape in mSignature
+     */
+    void rememberShape(const std::vector<float>& features);
+
+    /**
+     * @brief  Features of a shape, from the cache or the encoder
+     * @retval false if the encoder failed
+     */
+    bool encodeFeatures(
+        const std::vector<float>& vertices,
+        std::vector<float>& features
+    );
+
+    /**
+     * @brief  Take over the features of a shape and predict, on the fc lane
+     * @param  approximate: the features are those of a recent shape that
+     * stands in for it, see findRecentShape
+     */
+    void applyFeatures(
+        uint64_t generation,
+        const std::vector<float>& features,
+        const std::vector<float>& vertices,
+        bool approximate
+    );
+
+    /**
+     * @brief  Post a job to a lane, counting it in the telemetry
+     * @note   The fc lane runs interactive, the encoder lane at encoder
+     * priority, unless a priority is given
+     */
+    void postJob(InferenceTelemetry::Lane lane, std::function<void()> job);
+    void postJob(
+        InferenceTelemetry::Lane lane,
+        TaskPriority priority,
+        std::function<void()> job
+    );
+
+    /**
+     * @brief  Write a cache entry in the background
+     */
+    void storeInCache(
+        const InferenceCache::Key& key,
+        const float* values,
+        size_t numValues
+    );
+
+    // indices of the parameters, see setParameter
+    enum ParameterIndex
+    {
+        kDensity,
+        kStiffness,
+        kPRatio,
+        kAlpha,
+        kBeta,
+        kXPos,
+        kYPos,
+        kMorph,
+        kNumParameters
+    };
+
+    /**
+     * @brief  The index of a parameter id, -1 if it is not an fc input
+     */
+    static int getParameterIndex(const juce::String& parameterID);
+    static const char* getParameterID(int index);
+
+    /**
+     * @brief  The index of a PARAM tree, resolved from its id the first
+     * time and remembered, on the message thread
+     */
+    int findParameterIndex(const juce::ValueTree& parameterTree);
+
+    /**
+     * @brief  Write a parameter into a state, converting the position to
+     * the space of the network
+     */
+    static void setParameter(ResonatorState& state, int index, float value);
+
+    /**
+     * @brief  Publish the listener state and post a job that applies it,
+     * unless one is pending
+     */
+    void publishState();
+
+    /**
+     * @brief  Apply the latest published state, on the fc lane
+     */
+    void applyState();
+
+    /**
+     * @brief  Copy a state into the fc input and predict, morphing first if
+     * needed, on the fc lane
+     */
+    void applyParameters(const ResonatorState& state);
+
+    /**
+     * @brief  Apply the changes queued by pollParameters, on the fc lane
+     * @note   Every block that changed something is predicted, in the
+     * order of the stamps
+     */
+    void drainAutomation();
+
+    /**
+     * @brief  Run a job on the fc lane once the shapes queued before it are
+     * applied, and wait for it
+     * @retval false if it did not finish within kSynchronousTimeoutMs
+     */
+    bool runAfterQueuedShapes(std::function<void()> job);
+
+    /**
+     * @brief  See predictBatchSynchronously, on the fc lane
+     * @note   Reads the features and the networks only. The features are
+     * morphed per state with the state's morph amount.
+     */
+    bool predictBatch(
+        const std::vector<ResonatorState>& states,
+        float* coefficients
+    );
+
+    /**
+     * @brief  Write the shape features, morphed if needed, into the fc
+     * input and predict, on the fc lane
+     */
+    void updateFeatures();
+    bool isMorphing() const;
+
+    /**
+     * @brief  The shape features morphed towards the targets
+     * @param  features: kNumFeatures floats
+     */
+    void mixFeatures(float morph, float* features) const;
+
+    /**
+     * @brief  Convert the flattened [-1, 1] vertices of the polygon tree to
+     * pixel coordinates
+     */
+    static std::vector<float> flattenedVerticesToPixels(
+        const juce::var& flattenedVertices
+    );
+
+public:
+    static constexpr int kImageSize = 64;
+    static constexpr int kNumImageChannels = 3;
+    static constexpr int kNumFeatures = 1000;
+    static constexpr int kNumPositions = 2;
+    static constexpr int kNumMaterials = 5;
+    static constexpr int kNumCoefficients = 32 * 2 * 6;
+
 private:
+    static constexpr float kFoldTolerance = 1e-3f;
+    static constexpr float kSplitTolerance = 1e-4f;
+    static constexpr float kNativeTolerance = 1e-4f;
+    // a 256th of a pixel, far below what the rasterizer resolves
+    static constexpr float kCacheVertexStep = 1.0f / 256.0f;
+    // the parameters move in steps of 0.01
+    static constexpr float kCacheParameterStep = 1e-4f;
+    // coarse raster used to match previews against recent shapes
+    static constexpr int kSignatureSize = 16;
+    static constexpr size_t kNumRecentShapes = 64;
+    // about a pixel of a vertex move at the encoder resolution
+    static constexpr float kPreviewTolerance = 0.05f;
+    // a request to the inference host that takes longer runs in process
+    static constexpr int kRemoteTimeoutMs = 250;
+    // how long an offline render waits for a synchronous prediction, it
+    // stops predicting synchronously after the first timeout
+    static constexpr int kSynchronousTimeoutMs = 2000;
+
     torch::jit::Module mShapeEncoderNetwork;
     torch::jit::Module mFCNetwork;
 
-    // intermediate tensor for features
+    // the polygon is rasterized directly into mImageTensor
+    PolygonRasterizer mRasterizer{kImageSize, kImageSize};
+
+    // recently encoded shapes for the preview tier, encoder lane only
+    struct RecentShape
+    {
+        std::vector<float> signature;
+        std::vector<float> features;
+    };
+    PolygonRasterizer mSignatureRasterizer{kSignatureSize, kSignatureSize};
+    std::vector<float> mSignatureVertices;
+    std::vector<float> mSignature =
+        std::vector<float>(size_t(kSignatureSize * kSignatureSize));
+    std::vector<RecentShape> mRecentShapes;
+    size_t mNextRecentShape = 0;
+
+    // the latest encoded shape and morph targets, encoder lane only, they
+    // are re-encoded when the encoder is swapped
+    uint64_t mEncodedGeneration = 0;
+    std::vector<float> mEncodedVertices;
+    std::vector<std::vector<float>> mMorphTargetVertices;
+
+    // generations of the latest shape and of the shape whose features are
+    // in the fc input
+    std::atomic<uint64_t> mShapeGeneration{0};
+    uint64_t mAppliedShapeGeneration = 0;
+
+    // generation of the latest morph slots, older ones are dropped
+    std::atomic<uint64_t> mMorphGeneration{0};
+
+    // the parameters, written by the listeners on the message thread and
+    // published through a seqlock. The fc lane copies the latest snapshot
+    // into the fc input before it predicts, so a burst of changes costs
+    // one prediction.
+    ResonatorState mListenerState;
+    ResonatorStateLock mState;
+    std::atomic<bool> mStatePending{false};
+    ResonatorState mAppliedState;
+    uint64_t mAppliedStateVersion = 0;
+    // PARAM trees and their index, message thread only
+    std::vector<std::pair<juce::ValueTree, int>> mParameterTrees;
+
+    // parameter changes seen by the audio thread, see pollParameters. The
+    // raw values and the last queued ones are read on the audio thread,
+    // the drained events belong to the fc lane.
+    static constexpr int kAutomationQueueSize = 256;
+    ParameterEventQueue mAutomation{kAutomationQueueSize, kNumParameters};
+    std::atomic<float>* mRawParameters[kNumParameters] = {};
+    float mPolledValues[kNumParameters] = {};
+    std::atomic<bool> mAudioThreadPolling{false};
+    // set by the audio thread until the wakeup posted the drain
+    std::atomic<bool> mAutomationWake{false};
+    juce::SharedResourcePointer<AutomationWakeup> mAutomationWakeup;
+    std::vector<ParameterEventQueue::Event> mAutomationEvents;
+
+    // counts the predictions on the fc lane, a batched result is only
+    // delivered if no newer prediction started in the meantime
+    uint64_t mPredictionGeneration = 0;
+
+    // neighbours of the latest change waiting to be prefetched, fc lane
+    // only, a new change bumps the generation
+    static constexpr int kNumPrefetchSteps = 2;
+    // the interval of the parameters in the ui space
+    static constexpr float kParameterStep = 0.01f;
+    std::atomic<bool> mPrefetchEnabled{false};
+    std::vector<ResonatorState> mPrefetchStates;
+    size_t mNextPrefetch = 0;
+    uint64_t mPrefetchGeneration = 0;
+    std::vector<float> mPrefetchCoefficients =
+        std::vector<float>(size_t(kNumCoefficients));
+
+    // features of the current shape and of the morph targets, fc lane only
+    std::vector<float> mShapeFeatures;
+    bool mShapeFeaturesReady = false;
+    // the features stand in for mShapeVertices, their coefficients are not
+    // cached under its key
+    bool mShapeApproximate = false;
+    std::vector<std::vector<float>> mMorphTargets;
+    float mMorphAmount = 0.0f;
+
+    // persistent input tensors, allocated once and written in place
+    // mImageTensor is the 1x1x64x64 raster, mEncoderInputTensor is a 1x3x64x64
+    // expanded (stride 0) view of it. When the channels are folded into the
+    // encoder, mImageTensor is fed directly.
+    torch::Tensor mImageTensor;
+    torch::Tensor mEncoderInputTensor;
+
+    // mFCInputTensor is the 1x1007 input of the fc network. The feature
+    // and parameter tensors are slices (views) of it, so no concatenation
+    // is needed before each prediction.
+    torch::Tensor mFCInputTensor;
     torch::Tensor mFeatureTensor;
-    torch::Tensor mLastMaterialTensor;
-    torch::Tensor mLastPositionTensor;
+
+    // split fc network, it only takes the position and material
+    // (mParameterTensor, a view of mFCInputTensor). The feature part of its
+    // first layer is recomputed from mFeatureVector for every new shape.
+    torch::jit::Module mFCSplitNetwork;
+    ModelTransforms::SplitLinear mFCSplit;
+    torch::Tensor mParameterTensor;
+    torch::Tensor mFeatureVector;
+    bool mFCSplitAvailable = false;
+    std::atomic<bool> mFCSplitEnabled{true};
+
+    // native evaluator of the fc network, preferred over libtorch when its
+    // graph is supported. mNativePrefix caches the feature part of the first
+    // layer for the current shape.
+    std::shared_ptr<const MLPEvaluator> mNativeFC;
+    MLPEvaluator::Workspace mNativeWorkspace;
+    std::vector<float> mNativePrefix;
+    std::atomic<bool> mNativeFCEnabled{true};
+    std::atomic<bool> mAudioThreadInference{false};
+
+    // jacobian of the fc network at the latest parameters, the identity
+    // is the grad output of its batched backward pass
+    std::atomic<bool> mLinearizationEnabled{false};
+    std::atomic<bool> mLinearizationPending{false};
+    CoefficientLinearization mLinearization;
+    bool mHasLinearization = false;
+    torch::Tensor mLinearizationGradOutputs;
+
+    // persistent cache, keyed by the hashes of the model files.
+    // mEncoderHash belongs to the encoder lane, mFCHash and mFCEncoderHash
+    // (the encoder of the features in the fc input) to the fc lane
+    juce::SharedResourcePointer<InferenceCache> mCache;
+    std::atomic<bool> mCacheEnabled{true};
+    uint64_t mEncoderHash = 0;
+    uint64_t mFCHash = 0;
+    uint64_t mFCEncoderHash = 0;
+    // false if the model file could not be read, nothing keyed by the
+    // hash is cached then
+    bool mEncoderHashed = false;
+    bool mFCHashed = false;
+    bool mFCEncoderHashed = false;
+
+    // shared by all instances, see setBatchingEnabled
+    juce::SharedResourcePointer<InferenceBatcher> mBatcher;
+    std::atomic<bool> mBatchingEnabled{false};
+
+    // channels to the inference host and the model files they name, owned
+    // by the encoder and the fc lane
+    std::unique_ptr<RemoteInferenceChannel> mRemoteEncoder;
+    std::unique_ptr<RemoteInferenceChannel> mRemoteFC;
+    juce::String mEncoderLanePath;
+    juce::String mFCLanePath;
+    // false while a deferred model is only served by the host
+    bool mEncoderLoaded = true;
+    bool mFCLoaded = true;
+    // whether the lanes last heard from the host, read by the loader
+    std::atomic<bool> mRemoteEncoderConnected{false};
+    std::atomic<bool> mRemoteFCConnected{false};
+
+    // paths of the models in use and of the ones being loaded, message
+    // thread only
+    juce::String mEncoderModelPath;
+    juce::String mFCModelPath;
+    juce::String mPendingEncoderPath;
+    juce::String mPendingFCPath;
+    // directory of the bundled models, anything under it may be loaded
+    juce::File mModelDirectory;
+    std::mutex mModelLoadResultsLock;
+    std::vector<ModelLoadResult> mModelLoadResults;
+    std::vector<float> mShapeVertices;
+
+    // the inputs are boxed once and reused for every forward call
+    std::vector<torch::jit::IValue> mEncoderInputs;
+    std::vector<torch::jit::IValue> mFCInputs;
+    std::vector<torch::jit::IValue> mFCSplitInputs;
+
     std::vector<float> mCoefficients;
 
     // flags
@@ -90,7 +876,12 @@ private:
     // access the processor object that created it.
     ProcessorIf* mProcessorPtr;
 
-    QueueThread mQueueThread{"torch_wrapper"};
+    // the fc lane, the encoder lane, the model loader and the cache
+    // writes, serial queues on the executor shared by all instances
+    TaskStrand mFCStrand{"torch_wrapper", TaskPriority::Interactive};
+    TaskStrand mEncoderStrand{"torch_encoder", TaskPriority::Encoder};
+    TaskStrand mLoaderStrand{"torch_loader", TaskPriority::Background};
+    TaskStrand mCacheStrand{"torch_cache", TaskPriority::Background};
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(TorchWrapper)
 };
@@ -0,0 +1,457 @@
+// Out-of-process inference host. It serves the encoder and fc networks to
+// every plugin instance on the machine through the shared memory channels
+// described in RemoteProtocol.h, so the hosts of the plugin do not need to
+// run libtorch and a crash of the models stays in this process. The plugin
+// falls back to in-process inference while it is not running.
+
+#include "RemoteProtocol.h"
+#include "PolygonRasterizer.h"
+
+#include <juce_core/juce_core.h>
+#include <torch/script.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+
+class InferenceHost
+{
+public:
+    InferenceHost()
+        : mRequest(std::make_unique<RemoteProtocol::Slot>())
+        , mResponse(std::make_unique<RemoteProtocol::Slot>())
+    {
+        mImageTensor = torch::zeros({1, 1, kImageSize, kImageSize});
+        mLoader = std::thread([this] { loadModels(); });
+    }
+
+    ~InferenceHost()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mModelLock);
+            mExiting = true;
+        }
+        mLoadRequested.notify_one();
+        mLoader.join();
+    }
+
+    void run()
+    {
+        log(
+            "serving " +
+            RemoteProtocol::getChannelDirectory().getFullPathName()
+        );
+
+        int64_t lastScan = 0;
+        int64_t lastHeartbeat = 0;
+        while (true)
+        {
+            auto now = juce::Time::currentTimeMillis();
+            if (now - lastScan >= kScanIntervalMs)
+            {
+                scanChannels();
+                lastScan = now;
+            }
+            if (now - lastHeartbeat >= RemoteProtocol::kHeartbeatIntervalMs)
+            {
+                for (auto &entry : mChannels)
+                {
+                    entry.second.channel->hostHeartbeat = now;
+                }
+                lastHeartbeat = now;
+            }
+
+            bool busy = false;
+            for (auto &entry : mChannels) { busy |= serve(entry.second); }
+            if (!busy) { juce::Thread::sleep(1); }
+        }
+    }
+
+private:
+    static void log(const juce::String &message)
+    {
+        juce::Logger::writeToLog("Inference host: " + message);
+    }
+
+    struct MappedChannel
+    {
+        std::unique_ptr<juce::MemoryMappedFile> mapping;
+        RemoteProtocol::Channel *channel = nullptr;
+        uint32_t modelGeneration = 0;
+        juce::String modelPath;
+        // waiting for the loader
+        bool modelPending = false;
+        std::shared_ptr<torch::jit::Module> model;
+    };
+
+    /**
+     * @brief  Whether the plugin of a channel stopped sending heartbeats
+     */
+    static bool isAbandoned(const RemoteProtocol::Channel &channel)
+    {
+        auto now = juce::Time::currentTimeMillis();
+        return now - channel.clientHeartbeat.load() >
+               RemoteProtocol::kClientTimeoutMs;
+    }
+
+    /**
+     * @brief  Map new channel files and drop the ones that were deleted
+     * @note   Channels abandoned by a crashed plugin are unmapped and their
+     * files deleted, otherwise they would be served forever. The models
+     * the channels name are requested from the loader here, so a load
+     * never holds up serving the other channels.
+     */
+    void scanChannels()
+    {
+        auto directory = RemoteProtocol::getChannelDirectory();
+        for (auto it = mChannels.begin(); it != mChannels.end();)
+        {
+            juce::File file(it->first);
+            if (!file.existsAsFile())
+            {
+                log("channel closed " + it->first);
+                it = mChannels.erase(it);
+            }
+            else if (isAbandoned(*it->second.channel))
+            {
+                log("channel abandoned " + it->first);
+                it = mChannels.erase(it);
+                file.deleteFile();
+            }
+            else { ++it; }
+        }
+
+        auto files = directory.findChildFiles(
+            juce::File::findFiles,
+            false,
+            "*.channel"
+        );
+        for (const auto &file : files)
+        {
+            auto path = file.getFullPathName();
+            if (mChannels.count(path) > 0) { continue; }
+
+            MappedChannel mapped;
+            mapped.mapping = std::make_unique<juce::MemoryMappedFile>(
+                file,
+                juce::MemoryMappedFile::readWrite,
+                false
+            );
+            // a channel that is still being initialised is retried on the
+            // next scan, unless the plugin crashed before it was done
+            auto now = juce::Time::getCurrentTime();
+            bool old = (now - file.getLastModificationTime())
+                           .inMilliseconds() >
+                       RemoteProtocol::kClientTimeoutMs;
+            if (mapped.mapping->getData() == nullptr ||
+                mapped.mapping->getSize() < sizeof(RemoteProtocol::Channel))
+            {
+                mapped.mapping.reset();
+                if (old) { deleteChannel(file); }
+                continue;
+            }
+
+            mapped.channel = static_cast<RemoteProtocol::Channel *>(
+                mapped.mapping->getData()
+            );
+            if (mapped.channel->magic.load(std::memory_order_acquire) !=
+                    RemoteProtocol::kMagic ||
+                mapped.channel->version != RemoteProtocol::kVersion)
+            {
+                mapped.mapping.reset();
+                if (old) { deleteChannel(file); }
+                continue;
+            }
+            if (isAbandoned(*mapped.channel))
+            {
+                mapped.mapping.reset();
+                deleteChannel(file);
+                continue;
+            }
+
+            log("channel opened " + path);
+            mChannels[path] = std::move(mapped);
+        }
+
+        for (auto &entry : mChannels) { updateModel(entry.second); }
+        releaseModels();
+    }
+
+    static void deleteChannel(const juce::File &file)
+    {
+        if (file.deleteFile())
+        {
+            log("deleted abandoned channel " + file.getFullPathName());
+        }
+    }
+
+    /**
+     * @brief  Request the model named by the channel if it changed, and
+     * take it once it is loaded
+     * @note   Never waits for the loader, the channel answers
+     * ModelNotLoaded meanwhile.
+     */
+    void updateModel(MappedChannel &mapped)
+    {
+        auto generation =
+            mapped.channel->modelGeneration.load(std::memory_order_acquire);
+        if (generation != mapped.modelGeneration)
+        {
+            // the plugin may rewrite the path while it is copied
+            char path[RemoteProtocol::kMaxPathLength];
+            std::memcpy(path, mapped.channel->modelPath, sizeof(path));
+            path[sizeof(path) - 1] = '\0';
+            if (mapped.channel->modelGeneration.load(
+                    std::memory_order_acquire
+                ) != generation)
+            {
+                return;
+            }
+
+            mapped.modelGeneration = generation;
+            mapped.modelPath = juce::String::fromUTF8(path);
+            mapped.model = nullptr;
+            mapped.modelPending = true;
+            requestModel(mapped.modelPath);
+        }
+        if (!mapped.modelPending) { return; }
+
+        std::lock_guard<std::mutex> lock(mModelLock);
+        auto it = mModels.find(mapped.modelPath);
+        if (it == mModels.end()) { return; }
+        mapped.model = it->second;
+        mapped.modelPending = false;
+    }
+
+    /**
+     * @brief  Queue a model file for the loader, unless it is loaded or
+     * queued already
+     * @note   A file that failed to load is tried again
+     */
+    void requestModel(const juce::String &path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mModelLock);
+            auto it = mModels.find(path);
+            if (it != mModels.end() && it->second != nullptr) { return; }
+            if (it != mModels.end()) { mModels.erase(it); }
+            if (mLoading.count(path) > 0) { return; }
+            mLoading.insert(path);
+            mLoadQueue.push_back(path);
+        }
+        mLoadRequested.notify_one();
+    }
+
+    /**
+     * @brief  Drop the loaded models no channel uses or waits for
+     */
+    void releaseModels()
+    {
+        std::set<juce::String> pending;
+        for (auto &entry : mChannels)
+        {
+            if (entry.second.modelPending)
+            {
+                pending.insert(entry.second.modelPath);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mModelLock);
+        for (auto it = mModels.begin(); it != mModels.end();)
+        {
+            if (pending.count(it->first) == 0 &&
+                (it->second == nullptr || it->second.use_count() == 1))
+            {
+                if (it->second != nullptr) { log("unloaded " + it->first); }
+                it = mModels.erase(it);
+            }
+            else { ++it; }
+        }
+    }
+
+    /**
+     * @brief  Loader thread, models are shared between the channels that
+     * use the same file
+     */
+    void loadModels()
+    {
+        while (true)
+        {
+            juce::String path;
+            {
+                std::unique_lock<std::mutex> lock(mModelLock);
+                mLoadRequested.wait(
+                    lock,
+                    [this] { return mExiting || !mLoadQueue.empty(); }
+                );
+                if (mExiting) { return; }
+                path = mLoadQueue.front();
+                mLoadQueue.pop_front();
+            }
+
+            std::shared_ptr<torch::jit::Module> model;
+            try
+            {
+                model = std::make_shared<torch::jit::Module>(
+                    torch::jit::load(path.toStdString())
+                );
+                model->eval();
+                log("loaded " + path);
+            }
+            catch (const c10::Error &e)
+            {
+                log(
+                    "error loading " + path + " " +
+                    std::string(e.what())
+                );
+                model = nullptr;
+            }
+
+            // a failed load is stored too, so the channels stop waiting
+            std::lock_guard<std::mutex> lock(mModelLock);
+            mModels[path] = model;
+            mLoading.erase(path);
+        }
+    }
+
+    /**
+     * @brief  Answer the oldest request of a channel
+     * @retval true if there was one
+     */
+    bool serve(MappedChannel &mapped)
+    {
+        auto &channel = *mapped.channel;
+        if (!RemoteProtocol::pop(channel.requests, *mRequest))
+        {
+            return false;
+        }
+
+        updateModel(mapped);
+
+        auto &response = *mResponse;
+        response.sequence = mRequest->sequence;
+        response.numValues = 0;
+        response.status = mapped.model == nullptr
+                              ? RemoteProtocol::Status::ModelNotLoaded
+                              : RemoteProtocol::Status::Ok;
+
+        if (response.status == RemoteProtocol::Status::Ok)
+        {
+            response.status = channel.modelKind ==
+                                      RemoteProtocol::ModelKind::Encoder
+                                  ? encode(*mapped.model)
+                                  : predict(*mapped.model);
+        }
+
+        // the response ring is only consumed by the plugin, a full one
+        // means it has given up on these requests, it drops stale
+        // responses before its next call
+        if (!RemoteProtocol::push(channel.responses, response))
+        {
+            log("response ring full, dropped a response");
+        }
+        return true;
+    }
+
+    RemoteProtocol::Status encode(torch::jit::Module &encoder)
+    {
+        if (mRequest->numValues % 2 != 0 || mRequest->numValues < 6)
+        {
+            return RemoteProtocol::Status::InvalidRequest;
+        }
+
+        c10::InferenceMode guard;
+        try
+        {
+            mRasterizer.rasterize(
+                mRequest->values,
+                mRequest->numValues / 2,
+                mImageTensor.data_ptr<float>()
+            );
+            std::vector<torch::jit::IValue> inputs{mImageTensor.expand(
+                {1, kNumImageChannels, kImageSize, kImageSize}
+            )};
+            return copyOutput(encoder.forward(inputs).toTensor());
+        }
+        catch (const c10::Error &e)
+        {
+            log("encoder failed " + std::string(e.what()));
+            return RemoteProtocol::Status::InferenceFailed;
+        }
+    }
+
+    RemoteProtocol::Status predict(torch::jit::Module &fc)
+    {
+        c10::InferenceMode guard;
+        try
+        {
+            auto input = torch::from_blob(
+                mRequest->values,
+                {1, int64_t(mRequest->numValues)}
+            );
+            std::vector<torch::jit::IValue> inputs{input};
+            return copyOutput(fc.forward(inputs).toTensor());
+        }
+        catch (const c10::Error &e)
+        {
+            log("fc failed " + std::string(e.what()));
+            return RemoteProtocol::Status::InferenceFailed;
+        }
+    }
+
+    RemoteProtocol::Status copyOutput(const torch::Tensor &output)
+    {
+        auto values = output.contiguous();
+        if (values.numel() > RemoteProtocol::kMaxValues)
+        {
+            return RemoteProtocol::Status::InferenceFailed;
+        }
+        mResponse->numValues = uint32_t(values.numel());
+        std::memcpy(
+            mResponse->values,
+            values.data_ptr<float>(),
+            size_t(values.numel()) * sizeof(float)
+        );
+        return RemoteProtocol::Status::Ok;
+    }
+
+private:
+    static constexpr int kImageSize = 64;
+    static constexpr int kNumImageChannels = 3;
+    static constexpr int64_t kScanIntervalMs = 500;
+
+    std::map<juce::String, MappedChannel> mChannels;
+
+    // loaded models by path, nullptr if the load failed. Under mModelLock
+    // with the queue of the loader
+    std::mutex mModelLock;
+    std::map<juce::String, std::shared_ptr<torch::jit::Module>> mModels;
+    std::deque<juce::String> mLoadQueue;
+    std::set<juce::String> mLoading;
+    std::condition_variable mLoadRequested;
+    bool mExiting = false;
+    std::thread mLoader;
+
+    PolygonRasterizer mRasterizer{kImageSize, kImageSize};
+    torch::Tensor mImageTensor;
+    std::unique_ptr<RemoteProtocol::Slot> mRequest;
+    std::unique_ptr<RemoteProtocol::Slot> mResponse;
+};
+
+int main()
+{
+    // one host serves the whole machine
+    juce::InterProcessLock lock("NeuralResonatorInferenceHost");
+    if (!lock.enter(0))
+    {
+        juce::Logger::writeToLog("Inference host: already running");
+        return 1;
+    }
+
+    InferenceHost host;
+    host.run();
+    return 0;
+}
@@ -7,6 +7,11 @@ int main(int argc, char* argv[])
 {
     int sampleRate = 44100;
     int blockSize = 32;
+
+    // the inference runs on this thread when stepped, so the first block
+    // is rendered with the predicted coefficients
+    juce::SharedResourcePointer<TaskExecutor> executor;
+    executor->setMode(TaskExecutor::Mode::Manual);
     AudioPluginAudioProcessor processor;
 
     // Debug all parameters
@@ -17,6 +22,17 @@ int main(int argc, char* argv[])
 
     processor.prepareToPlay(sampleRate, blockSize);
 
+    // load the models, encode the default shape and predict
+    auto startTicks = juce::Time::getHighResolutionTicks();
+    int numTasks = executor->runUntilIdle();
+    auto seconds = juce::Time::highResolutionTicksToSeconds(
+        juce::Time::getHighResolutionTicks() - startTicks
+    );
+    JLOG(
+        "Ran " + juce::String(numTasks) + " inference tasks in " +
+        juce::String(seconds * 1000.0, 2) + " ms"
+    );
+
     // Create a stereo buffer with 512 samples
     juce::AudioBuffer<float> buffer(2, blockSize);
     
@@ -0,0 +1,603 @@
+// Tests for the inference pipeline, they run without a host or an editor.
+// Each test logs what it checks and returns false on failure.
+
+#include "../HelperFunctions.h"
+#include "../ConsoleLogger.h"
+#include "../PolygonRasterizer.h"
+#include "../ModelTransforms.h"
+#include "../MLPEvaluator.h"
+#include "../TaskExecutor.h"
+#include "../ResonatorState.h"
+#include "../ParameterEventQueue.h"
+#include "../InferenceBatcher.h"
+#include <geometry/generate_polygon.hpp>
+#include <geometry/morphisms.hpp>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <thread>
+#include <vector>
+
+static std::vector<float> randomPolygonInPixels(
+    unsigned long numVertices,
+    int res
+)
+{
+    auto polygon = kac_core::geometry::normalisePolygon(
+        kac_core::geometry::generateConvexPolygon(numVertices)
+    );
+
+    // same mapping as the torch wrapper: [0, 1] to [0, res] with the
+    // y axis flipped
+    std::vector<float> vertices;
+    for (size_t i = 0; i < polygon.size(); i++)
+    {
+        vertices.push_back(float(polygon[i].x) * res);
+        vertices.push_back(res - float(polygon[i].y) * res);
+    }
+    return vertices;
+}
+
+static bool testRasterizerMatchesJuce()
+{
+    JLOG("Test: PolygonRasterizer matches juce::Graphics::fillPath");
+
+    const int res = 64;
+    const float maxTolerance = 0.05f;
+    const float meanTolerance = 0.005f;
+
+    PolygonRasterizer rasterizer(res, res);
+    std::vector<float> raster(res * res);
+    bool passed = true;
+
+    for (unsigned long numVertices = 3; numVertices <= 50; numVertices++)
+    {
+        auto vertices = randomPolygonInPixels(numVertices, res);
+        auto numPolygonVertices = vertices.size() / 2;
+
+        juce::Path path;
+        for (size_t i = 0; i < numPolygonVertices; i++)
+        {
+            if (i == 0)
+            {
+                path.startNewSubPath(vertices[2 * i], vertices[2 * i + 1]);
+            }
+            else { path.lineTo(vertices[2 * i], vertices[2 * i + 1]); }
+        }
+        path.closeSubPath();
+
+        rasterizer.rasterize(
+            vertices.data(),
+            numPolygonVertices,
+            raster.data()
+        );
+
+        auto image = HelperFunctions::shapeToImage(path, res, res);
+        juce::Image::BitmapData bitmapData(
+            image,
+            juce::Image::BitmapData::readOnly
+        );
+
+        float maxError = 0.0f;
+        float meanError = 0.0f;
+        for (int y = 0; y < res; y++)
+        {
+            for (int x = 0; x < res; x++)
+            {
+                auto expected = bitmapData.getPixelPointer(x, y)[0] / 255.0f;
+                auto error = std::abs(expected - raster[y * res + x]);
+                maxError = std::max(maxError, error);
+                meanError += error;
+            }
+        }
+        meanError /= float(res * res);
+
+        if (maxError > maxTolerance || meanError > meanTolerance)
+        {
+            JLOG(
+                "  " + juce::String(numVertices) +
+                " vertices: max error " + juce::String(maxError) +
+                ", mean error " + juce::String(meanError)
+            );
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+static bool testEncoderFoldMatchesOriginal()
+{
+    JLOG("Test: folded encoder input matches the 3 channel input");
+
+    const int res = 64;
+    const int numChannels = 3;
+    const float tolerance = 1e-3f;
+
+    auto encoderPath = HelperFunctions::findResourcePath("encoder.pt");
+    torch::jit::Module encoder;
+    try
+    {
+        encoder = torch::jit::load(encoderPath.toStdString());
+        encoder.eval();
+    }
+    catch (const c10::Error& e)
+    {
+        JLOG("  Error loading the encoder: " + std::string(e.what()));
+        return false;
+    }
+
+    auto folded = encoder.deepcopy();
+    if (!ModelTransforms::foldRepeatedInputChannels(folded, numChannels))
+    {
+        JLOG("  Could not fold the encoder input");
+        return false;
+    }
+
+    c10::InferenceMode guard;
+    PolygonRasterizer rasterizer(res, res);
+    auto image = torch::zeros({1, 1, res, res});
+    bool passed = true;
+
+    for (unsigned long numVertices = 3; numVertices <= 12; numVertices++)
+    {
+        auto vertices = randomPolygonInPixels(numVertices, res);
+        rasterizer.rasterize(
+            vertices.data(),
+            vertices.size() / 2,
+            image.data_ptr<float>()
+        );
+
+        std::vector<torch::jit::IValue> originalInputs{
+            image.repeat({1, numChannels, 1, 1})};
+        std::vector<torch::jit::IValue> foldedInputs{image};
+
+        auto reference = encoder.forward(originalInputs).toTensor();
+        auto features = folded.forward(foldedInputs).toTensor();
+
+        auto difference =
+            ModelTransforms::relativeMaxDifference(reference, features);
+        if (difference > tolerance)
+        {
+            JLOG(
+                "  " + juce::String(numVertices) +
+                " vertices: relative difference " + juce::String(difference)
+            );
+            passed = false;
+        }
+    }
+
+    return passed;
+}
+
+static bool testNativeFCMatchesLibtorch()
+{
+    JLOG("Test: native fc evaluator matches libtorch (with benchmark)");
+
+    const int numFeatures = 1000;
+    const int numParameters = 7;
+    const int numIterations = 1000;
+    const float tolerance = 1e-4f;
+
+    auto fcPath = HelperFunctions::findResourcePath("model_wrap.pt");
+    torch::jit::Module fc;
+    try
+    {
+        fc = torch::jit::load(fcPath.toStdString());
+        fc.eval();
+    }
+    catch (const c10::Error& e)
+    {
+        JLOG("  Error loading the fc network: " + std::string(e.what()));
+        return false;
+    }
+
+    // the torch wrapper would fall back to libtorch, but the bundled model
+    // is meant to run natively
+    auto native = MLPEvaluator::fromModule(fc);
+    if (!native)
+    {
+        JLOG("  Bundled fc graph not supported natively");
+        return false;
+    }
+
+    c10::InferenceMode guard;
+    auto workspace = native->createWorkspace();
+    std::vector<float> prefix(size_t(native->getPrefixSize()));
+    auto output = torch::empty({native->getNumOutputs()});
+
+    auto features = torch::rand({1, numFeatures});
+    auto parameters = torch::rand({1, numParameters});
+    auto input = torch::cat({features, parameters}, 1);
+    std::vector<torch::jit::IValue> inputs{input};
+
+    // correctness, both through the full input and through the prefix
+    auto reference = fc.forward(inputs).toTensor().reshape({-1});
+    native->forward(
+        input.data_ptr<float>(),
+        output.data_ptr<float>(),
+        workspace
+    );
+    auto fullDifference =
+        ModelTransforms::relativeMaxDifference(reference, output);
+
+    native->computePrefix(
+        features.data_ptr<float>(),
+        numFeatures,
+        prefix.data()
+    );
+    native->forwardWithPrefix(
+        prefix.data(),
+        parameters.data_ptr<float>(),
+        numFeatures,
+        output.data_ptr<float>(),
+        workspace
+    );
+    auto prefixDifference =
+        ModelTransforms::relativeMaxDifference(reference, output);
+
+    JLOG(
+        "  relative difference: full " + juce::String(fullDifference) +
+        ", prefix " + juce::String(prefixDifference)
+    );
+
+    // benchmark, the libtorch path includes the concatenation it used to do
+    auto timeIt = [numIterations](const std::function<void()>& fn)
+    {
+        fn();
+        auto start = juce::Time::getHighResolutionTicks();
+        for (int i = 0; i < numIterations; i++) { fn(); }
+        auto seconds = juce::Time::highResolutionTicksToSeconds(
+            juce::Time::getHighResolutionTicks() - start
+        );
+        return seconds * 1e6 / numIterations;
+    };
+
+    auto libtorchTime = timeIt(
+        [&]
+        {
+            std::vector<torch::jit::IValue> catInputs{
+                torch::cat({features, parameters}, 1)};
+            fc.forward(catInputs);
+        }
+    );
+    auto nativeTime = timeIt(
+        [&]
+        {
+            native->forward(
+                input.data_ptr<float>(),
+                output.data_ptr<float>(),
+                workspace
+            );
+        }
+    );
+    auto prefixTime = timeIt(
+        [&]
+        {
+            native->forwardWithPrefix(
+                prefix.data(),
+                parameters.data_ptr<float>(),
+                numFeatures,
+                output.data_ptr<float>(),
+                workspace
+            );
+        }
+    );
+
+    JLOG("  libtorch: " + juce::String(libtorchTime, 2) + " us per call");
+    JLOG("  native: " + juce::String(nativeTime, 2) + " us per call");
+    JLOG(
+        "  native (prefix): " + juce::String(prefixTime, 2) + " us per call"
+    );
+
+    return fullDifference <= tolerance && prefixDifference <= tolerance;
+}
+
+static bool testSteppedExecutor()
+{
+    JLOG("Test: TaskExecutor runs strand jobs inline or when stepped");
+
+    juce::SharedResourcePointer<TaskExecutor> executor;
+    std::vector<int> order;
+    bool passed = true;
+    {
+        TaskStrand strand("test_strand", TaskPriority::Background);
+
+        executor->setMode(TaskExecutor::Mode::Manual);
+        strand.post([&order] { order.push_back(2); });
+        strand.post(
+            TaskPriority::Interactive,
+            [&order, &strand]
+            {
+                order.push_back(0);
+                strand.post(
+                    TaskPriority::Encoder,
+                    [&order] { order.push_back(1); }
+                );
+            }
+        );
+        passed &= order.empty();
+        executor->runUntilIdle();
+        passed &= order == std::vector<int>({0, 1, 2});
+
+        executor->setMode(TaskExecutor::Mode::Inline);
+        strand.post([&order] { order.push_back(3); });
+        passed &= order.size() == 4;
+    }
+    executor->setMode(TaskExecutor::Mode::Pool);
+
+    JLOG(executor->getMetricsString());
+    return passed;
+}
+
+static bool testResonatorStateLockIsConsistent()
+{
+    JLOG("Test: ResonatorStateLock never hands out a torn state");
+
+    const int numWrites = 200000;
+
+    // every word of the i-th state is i, so a torn read mixes values
+    auto makeState = [](int i)
+    {
+        ResonatorState state;
+        for (auto& value : state.position) { value = float(i); }
+        for (auto& value : state.material) { value = float(i); }
+        state.morph = float(i);
+        return state;
+    };
+
+    ResonatorStateLock lock;
+    lock.write(makeState(0));
+    std::atomic<bool> done{false};
+    std::thread writer(
+        [&]
+        {
+            for (int i = 1; i <= numWrites; i++) { lock.write(makeState(i)); }
+            done = true;
+        }
+    );
+
+    int numReads = 0;
+    int numTorn = 0;
+    uint64_t lastVersion = 0;
+    bool ordered = true;
+    while (!done)
+    {
+        ResonatorState state;
+        auto version = lock.read(state);
+        ordered &= version >= lastVersion;
+        lastVersion = version;
+
+        auto expected = state.morph;
+        bool torn = false;
+        for (auto value : state.position) { torn |= value != expected; }
+        for (auto value : state.material) { torn |= value != expected; }
+        if (torn) { numTorn++; }
+        numReads++;
+    }
+    writer.join();
+
+    ResonatorState last;
+    lock.read(last);
+    JLOG(
+        "  " + juce::String(numReads) + " reads, " + juce::String(numTorn) +
+        " torn"
+    );
+    return numTorn == 0 && ordered && last.morph == float(numWrites);
+}
+
+static bool testParameterEventQueueOverflow()
+{
+    JLOG("Test: ParameterEventQueue keeps the latest value when full");
+
+    const int capacity = 4;
+    const int numIndices = 8;
+    ParameterEventQueue queue(capacity, numIndices);
+    bool passed = true;
+
+    // the fifo takes the first events, the rest go to the overflow slots
+    for (int i = 0; i < capacity; i++) { queue.push(i, float(i), i); }
+    queue.push(5, 50.0f, 4);
+    queue.push(5, 51.0f, 5);
+    queue.push(0, 10.0f, 6);
+
+    std::vector<std::pair<int, float>> events;
+    std::vector<int64_t> stamps;
+    auto drain = [&events, &stamps, &queue]
+    {
+        events.clear();
+        stamps.clear();
+        return queue.drain(
+            [&events, &stamps](int index, float value, int64_t stamp)
+            {
+                events.emplace_back(index, value);
+                stamps.push_back(stamp);
+            }
+        );
+    };
+
+    // queued events in order, then one latest value per overflowed index,
+    // in the order of their stamps
+    passed &= drain() == capacity + 2;
+    std::vector<std::pair<int, float>> expected{
+        {0, 0.0f}, {1, 1.0f}, {2, 2.0f}, {3, 3.0f}, {5, 51.0f}, {0, 10.0f}};
+    passed &= events == expected;
+    passed &= stamps == std::vector<int64_t>({0, 1, 2, 3, 5, 6});
+
+    // drained, the fifo takes events again
+    passed &= drain() == 0;
+    queue.push(5, 52.0f, 7);
+    passed &= drain() == 1 && events.front().second == 52.0f &&
+              stamps.front() == 7;
+
+    // concurrently, the last value of every index arrives
+    const int numPushes = 100000;
+    std::map<int, float> latest;
+    std::thread producer(
+        [&queue]
+        {
+            for (int i = 0; i < numPushes; i++)
+            {
+                queue.push(i % numIndices, float(i), i);
+            }
+        }
+    );
+    auto collect = [&latest, &queue]
+    {
+        queue.drain(
+            [&latest](int index, float value, int64_t)
+            {
+                // values of an index only grow if the order is kept
+                auto it = latest.find(index);
+                if (it != latest.end() && it->second > value)
+                {
+                    latest[-1] = value;
+                }
+                latest[index] = value;
+            }
+        );
+    };
+    while (latest.size() < size_t(numIndices) ||
+           latest[numIndices - 1] < float(numPushes - 1))
+    {
+        collect();
+    }
+    producer.join();
+    collect();
+
+    passed &= latest.count(-1) == 0;
+    for (int index = 0; index < numIndices; index++)
+    {
+        passed &= latest[index] == float(numPushes - numIndices + index);
+    }
+    return passed;
+}
+
+static bool testInferenceBatcher()
+{
+    JLOG("Test: InferenceBatcher scatters rows, replaces and cancels");
+
+    // y = 2x + 1, so every row tells where it came from
+    torch::jit::Module network("affine");
+    network.define(R"JIT(
+def forward(self, x):
+    return x * 2.0 + 1.0
+)JIT");
+    network.eval();
+
+    InferenceBatcher batcher;
+    bool passed = true;
+
+    // the rows of several owners come back to the right callbacks
+    {
+        const int numOwners = 4;
+        int owners[numOwners];
+        std::vector<std::vector<float>> outputs(numOwners);
+        std::atomic<int> numDone{0};
+        juce::WaitableEvent allDone;
+
+        batcher.setWindow(50.0);
+        for (int i = 0; i < numOwners; i++)
+        {
+            batcher.submit(
+                &owners[i],
+                1,
+                network,
+                {float(i), float(10 * i)},
+                [&, i](const std::vector<float>& output)
+                {
+                    outputs[i] = output;
+                    if (++numDone == numOwners) { allDone.signal(); }
+                }
+            );
+        }
+        passed &= allDone.wait(2000);
+        for (int i = 0; i < numOwners; i++)
+        {
+            passed &= outputs[i] ==
+                      std::vector<float>({2.0f * i + 1.0f, 20.0f * i + 1.0f});
+        }
+        JLOG(
+            "  " + juce::String(numOwners) + " requests in " +
+            juce::String(batcher.getNumBatches()) + " batches"
+        );
+        // the callbacks use the locals of this scope
+        for (auto& owner : owners) { batcher.cancel(&owner); }
+    }
+
+    // a newer submit of an owner replaces its pending one
+    {
+        int owner = 0;
+        std::vector<float> received;
+        std::atomic<int> numCallbacks{0};
+        juce::WaitableEvent done;
+
+        batcher.setWindow(200.0);
+        for (float value : {1.0f, 2.0f})
+        {
+            batcher.submit(
+                &owner,
+                1,
+                network,
+                {value},
+                [&](const std::vector<float>& output)
+                {
+                    received = output;
+                    numCallbacks++;
+                    done.signal();
+                }
+            );
+        }
+        passed &= done.wait(2000);
+        // give a second callback the time to show up
+        juce::Thread::sleep(300);
+        passed &= numCallbacks == 1;
+        passed &= received == std::vector<float>({5.0f});
+        batcher.cancel(&owner);
+    }
+
+    // cancel returns only after the running callback of the owner
+    {
+        int owner = 0;
+        std::atomic<bool> finished{false};
+        juce::WaitableEvent started;
+
+        batcher.setWindow(0.0);
+        batcher.submit(
+            &owner,
+            1,
+            network,
+            {1.0f},
+            [&](const std::vector<float>&)
+            {
+                started.signal();
+                juce::Thread::sleep(100);
+                finished = true;
+            }
+        );
+        passed &= started.wait(2000);
+        batcher.cancel(&owner);
+        passed &= finished.load();
+    }
+    return passed;
+}
+
+int main(int argc, char* argv[])
+{
+    ConsoleLogger logger;
+    juce::Logger::setCurrentLogger(&logger);
+
+    bool passed = true;
+    passed &= testRasterizerMatchesJuce();
+    passed &= testEncoderFoldMatchesOriginal();
+    passed &= testNativeFCMatchesLibtorch();
+    passed &= testSteppedExecutor();
+    passed &= testResonatorStateLockIsConsistent();
+    passed &= testParameterEventQueueOverflow();
+    passed &= testInferenceBatcher();
+
+    JLOG(passed ? "All tests passed" : "Some tests failed");
+    juce::Logger::setCurrentLogger(nullptr);
+    return passed ? 0 : 1;
+}